@@ -0,0 +1,279 @@
+#ifndef COMPRESSED_TEXTURE_H
+#define COMPRESSED_TEXTURE_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+extern "C" {
+#include <image_DXT.h>
+#include <image_helper.h>
+}
+
+#include <learnopengl/file_cache.h>
+
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// S3TC is an extension, glad only generated the core profile
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// bump whenever the container layout or the way textures are baked changes
+#define COMPRESSED_TEXTURE_VERSION 1
+#define COMPRESSED_TEXTURE_MAGIC 0x58545052 // "RPTX"
+
+struct CompressedTextureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t levelCount;
+    uint32_t width;
+    uint32_t height;
+    uint64_t sourceSize;
+    int64_t  sourceModified;
+    uint64_t sourceHash;
+};
+
+struct CompressedLevel {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset; // into CompressedTexture::data
+    uint64_t size;
+};
+
+// a block compressed image with its complete mip chain, ready for glCompressedTexImage2D
+struct CompressedTexture {
+    GLenum format = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<CompressedLevel> levels;
+    std::vector<unsigned char> data;
+};
+
+// outcome of TextureBaker::bake
+enum BakeResult {
+    BAKED,
+    BAKE_NO_SOURCE,          // the source file could not be read
+    BAKE_DECODE_FAILED,      // stb_image could not decode it
+    BAKE_UNSUPPORTED_FORMAT, // not an RGB or RGBA image
+    BAKE_COMPRESS_FAILED,    // DXT compression of a level failed
+    BAKE_WRITE_FAILED        // the container could not be written
+};
+
+inline const char *BakeResultString(BakeResult result)
+{
+    switch (result)
+    {
+    case BAKED: return "baked";
+    case BAKE_NO_SOURCE: return "could not read the source file";
+    case BAKE_DECODE_FAILED: return "could not decode the image";
+    case BAKE_UNSUPPORTED_FORMAT: return "not an RGB/RGBA image";
+    case BAKE_COMPRESS_FAILED: return "DXT compression failed";
+    case BAKE_WRITE_FAILED: return "could not write the bake";
+    }
+    return "unknown";
+}
+
+// Bakes catalog textures into DXT1 (opaque) or DXT5 (alpha) containers with precomputed mipmaps and
+// loads them back. Entries live next to the mesh cache and are keyed like it by the source file.
+class TextureBaker
+{
+public:
+    // folder holding the baked textures, relative to the working directory unless made absolute
+    static std::string &directory()
+    {
+        static std::string cacheDirectory = "cache/textures";
+        return cacheDirectory;
+    }
+
+    // set once the GL context reported S3TC support, baked textures are ignored until then
+    static std::atomic<bool> &enabled()
+    {
+        static std::atomic<bool> useCompressed(false);
+        return useCompressed;
+    }
+
+    // checks the extension list of the current context and enables the compressed path accordingly
+    static bool detectSupport()
+    {
+        GLint extensionCount = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+        bool supported = false;
+        for (GLint i = 0; i < extensionCount && !supported; i++)
+        {
+            const char *extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            supported = extension && (std::strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0 ||
+                std::strcmp(extension, "GL_NV_texture_compression_s3tc") == 0);
+        }
+        enabled() = supported;
+        return supported;
+    }
+
+    static bool isImageFile(const std::filesystem::path &path)
+    {
+        std::string extension = path.extension().string();
+        for (char &c : extension)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".tga" || extension == ".bmp";
+    }
+
+    static std::string entryPath(const std::string &sourcePath)
+    {
+        std::string key = canonicalPath(sourcePath);
+        return directory() + "/" + HashToString(HashBytes(key.data(), key.size())) + ".ctex";
+    }
+
+    // loads the baked version of sourcePath if there is an up to date one
+    static bool load(const std::string &sourcePath, CompressedTexture &texture)
+    {
+        std::ifstream file(entryPath(sourcePath), std::ios::binary);
+        if (!file)
+            return false;
+        CompressedTextureHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+            return false;
+        if (header.magic != COMPRESSED_TEXTURE_MAGIC || header.version != COMPRESSED_TEXTURE_VERSION || header.levelCount == 0 || header.levelCount > 32)
+            return false;
+
+        FileStamp source;
+        if (!GetFileStamp(sourcePath, source, false) || source.size != header.sourceSize || source.modified != header.sourceModified)
+            return false;
+        if (!GetFileStamp(sourcePath, source) || source.contentHash != header.sourceHash)
+            return false;
+
+        CompressedTexture loaded;
+        loaded.format = header.format;
+        loaded.width = static_cast<int>(header.width);
+        loaded.height = static_cast<int>(header.height);
+        loaded.levels.resize(header.levelCount);
+        if (!file.read(reinterpret_cast<char*>(loaded.levels.data()), loaded.levels.size() * sizeof(CompressedLevel)))
+            return false;
+        const CompressedLevel &last = loaded.levels.back();
+        loaded.data.resize(static_cast<size_t>(last.offset + last.size));
+        if (!file.read(reinterpret_cast<char*>(loaded.data.data()), loaded.data.size()))
+            return false;
+        for (const CompressedLevel &level : loaded.levels)
+            if (level.offset + level.size > loaded.data.size())
+                return false;
+
+        texture = std::move(loaded);
+        return true;
+    }
+
+    // decodes sourcePath, builds the mip chain, compresses every level and writes the container.
+    // only RGB and RGBA images are baked, everything else keeps using the uncompressed path.
+    static BakeResult bake(const std::string &sourcePath)
+    {
+        FileStamp source;
+        if (!GetFileStamp(sourcePath, source))
+            return BAKE_NO_SOURCE;
+        int width, height, nrComponents;
+        unsigned char *pixels = stbi_load(sourcePath.c_str(), &width, &height, &nrComponents, 0);
+        if (!pixels)
+            return BAKE_DECODE_FAILED;
+        if (nrComponents != 3 && nrComponents != 4)
+        {
+            stbi_image_free(pixels);
+            return BAKE_UNSUPPORTED_FORMAT;
+        }
+
+        CompressedTextureHeader header = {};
+        header.magic = COMPRESSED_TEXTURE_MAGIC;
+        header.version = COMPRESSED_TEXTURE_VERSION;
+        header.format = nrComponents == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        header.width = static_cast<uint32_t>(width);
+        header.height = static_cast<uint32_t>(height);
+        header.sourceSize = source.size;
+        header.sourceModified = source.modified;
+        header.sourceHash = source.contentHash;
+
+        std::vector<CompressedLevel> levels;
+        std::vector<unsigned char> data;
+        std::vector<unsigned char> level(pixels, pixels + static_cast<size_t>(width) * height * nrComponents);
+        stbi_image_free(pixels);
+        std::vector<unsigned char> nextLevel;
+        for (;;)
+        {
+            int compressedSize = 0;
+            unsigned char *compressed = nrComponents == 4
+                ? convert_image_to_DXT5(level.data(), width, height, nrComponents, &compressedSize)
+                : convert_image_to_DXT1(level.data(), width, height, nrComponents, &compressedSize);
+            if (!compressed)
+                return BAKE_COMPRESS_FAILED;
+            levels.push_back({ static_cast<uint32_t>(width), static_cast<uint32_t>(height), data.size(), static_cast<uint64_t>(compressedSize) });
+            data.insert(data.end(), compressed, compressed + compressedSize);
+            std::free(compressed);
+
+            if (width == 1 && height == 1)
+                break;
+            // same rounding as GL: every level halves and floors each side, down to 1x1
+            int nextWidth = width > 1 ? width / 2 : 1;
+            int nextHeight = height > 1 ? height / 2 : 1;
+            nextLevel.assign(static_cast<size_t>(nextWidth) * nextHeight * nrComponents, 0);
+            mipmap_image(level.data(), width, height, nrComponents, nextLevel.data(), width > 1 ? 2 : 1, height > 1 ? 2 : 1);
+            level.swap(nextLevel);
+            width = nextWidth;
+            height = nextHeight;
+        }
+        header.levelCount = static_cast<uint32_t>(levels.size());
+
+        std::vector<unsigned char> buffer(sizeof(header) + levels.size() * sizeof(CompressedLevel) + data.size());
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        std::memcpy(buffer.data() + sizeof(header), levels.data(), levels.size() * sizeof(CompressedLevel));
+        std::memcpy(buffer.data() + sizeof(header) + levels.size() * sizeof(CompressedLevel), data.data(), data.size());
+        if (!WriteFileAtomically(entryPath(sourcePath), buffer.data(), buffer.size()))
+        {
+            std::cout << "ERROR::TEXTURE_BAKER:: could not write " << entryPath(sourcePath) << std::endl;
+            return BAKE_WRITE_FAILED;
+        }
+        return BAKED;
+    }
+
+private:
+    static std::string canonicalPath(const std::string &path)
+    {
+        std::error_code error;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+        return (error ? std::filesystem::absolute(path) : canonical).generic_string();
+    }
+};
+
+// loads the bake of path (relative to directory) when compressed textures are enabled and the bake is up to date
+inline bool LoadCompressedTexture(const char *path, const std::string &directory, CompressedTexture &texture)
+{
+    if (!TextureBaker::enabled())
+        return false;
+    return TextureBaker::load(directory + '/' + std::string(path), texture);
+}
+
+// uploads every level of a baked texture into a new texture object, must run on the GL thread
+inline unsigned int UploadCompressedTexture(const CompressedTexture &texture)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    for (size_t i = 0; i < texture.levels.size(); i++)
+    {
+        const CompressedLevel &level = texture.levels[i];
+        glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), texture.format, level.width, level.height, 0,
+            static_cast<GLsizei>(level.size), texture.data.data() + level.offset);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(texture.levels.size()) - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return textureID;
+}
+#endif
@@ -65,7 +65,7 @@ public:
 		m_isDirty = true;
 	}
 
-	const glm::vec3& getGlobalPosition() const
+	glm::vec3 getGlobalPosition() const
 	{
 		return m_modelMatrix[3];
 	}
@@ -261,6 +261,9 @@ struct AABB : public BoundingVolume
 	glm::vec3 center{ 0.f, 0.f, 0.f };
 	glm::vec3 extents{ 0.f, 0.f, 0.f };
 
+	//World space boxes are tested with the transform-less overload
+	using BoundingVolume::isOnFrustum;
+
 	AABB(const glm::vec3& min, const glm::vec3& max)
 		: BoundingVolume{}, center{ (max + min) * 0.5f }, extents{ max.x - center.x, max.y - center.y, max.z - center.z }
 	{}
@@ -342,45 +345,54 @@ Frustum createFrustumFromCamera(const Camera& cam, float aspect, float fovY, flo
 	return frustum;
 }
 
-AABB generateAABB(const Model& model)
+//Frustum of any view projection matrix (e.g. a light's), planes extracted as in Gribb & Hartmann
+Frustum createFrustumFromMatrix(const glm::mat4& viewProjection)
 {
-	glm::vec3 minAABB = glm::vec3(std::numeric_limits<float>::max());
-	glm::vec3 maxAABB = glm::vec3(std::numeric_limits<float>::min());
-	for (auto&& mesh : model.meshes)
-	{
-		for (auto&& vertex : mesh.vertices)
-		{
-			minAABB.x = std::min(minAABB.x, vertex.Position.x);
-			minAABB.y = std::min(minAABB.y, vertex.Position.y);
-			minAABB.z = std::min(minAABB.z, vertex.Position.z);
+	const glm::mat4 m = glm::transpose(viewProjection); //rows of the matrix as columns
+	auto makePlane = [](const glm::vec4& coefficients)
+	{
+		Plane plane;
+		const float length = glm::length(glm::vec3(coefficients));
+		plane.normal = glm::vec3(coefficients) / length;
+		plane.distance = -coefficients.w / length;
+		return plane;
+	};
 
-			maxAABB.x = std::max(maxAABB.x, vertex.Position.x);
-			maxAABB.y = std::max(maxAABB.y, vertex.Position.y);
-			maxAABB.z = std::max(maxAABB.z, vertex.Position.z);
-		}
-	}
-	return AABB(minAABB, maxAABB);
+	Frustum frustum;
+	frustum.leftFace = makePlane(m[3] + m[0]);
+	frustum.rightFace = makePlane(m[3] - m[0]);
+	frustum.bottomFace = makePlane(m[3] + m[1]);
+	frustum.topFace = makePlane(m[3] - m[1]);
+	frustum.nearFace = makePlane(m[3] + m[2]);
+	frustum.farFace = makePlane(m[3] - m[2]);
+	return frustum;
 }
 
-Sphere generateSphereBV(const Model& model)
+//World space AABB enclosing an object space one transformed by modelMatrix
+AABB transformAABB(const AABB& box, const glm::mat4& modelMatrix)
 {
-	glm::vec3 minAABB = glm::vec3(std::numeric_limits<float>::max());
-	glm::vec3 maxAABB = glm::vec3(std::numeric_limits<float>::min());
-	for (auto&& mesh : model.meshes)
-	{
-		for (auto&& vertex : mesh.vertices)
-		{
-			minAABB.x = std::min(minAABB.x, vertex.Position.x);
-			minAABB.y = std::min(minAABB.y, vertex.Position.y);
-			minAABB.z = std::min(minAABB.z, vertex.Position.z);
+	const glm::vec3 globalCenter{ modelMatrix * glm::vec4(box.center, 1.f) };
 
-			maxAABB.x = std::max(maxAABB.x, vertex.Position.x);
-			maxAABB.y = std::max(maxAABB.y, vertex.Position.y);
-			maxAABB.z = std::max(maxAABB.z, vertex.Position.z);
-		}
-	}
+	// Scaled orientation
+	const glm::vec3 right = glm::vec3(modelMatrix[0]) * box.extents.x;
+	const glm::vec3 up = glm::vec3(modelMatrix[1]) * box.extents.y;
+	const glm::vec3 forward = glm::vec3(modelMatrix[2]) * box.extents.z;
+
+	return AABB(globalCenter,
+		std::abs(right.x) + std::abs(up.x) + std::abs(forward.x),
+		std::abs(right.y) + std::abs(up.y) + std::abs(forward.y),
+		std::abs(right.z) + std::abs(up.z) + std::abs(forward.z));
+}
+
+//Object space bounds computed at import, or read from the mesh cache (meshes built from it keep no vertices)
+AABB generateAABB(const Model& model)
+{
+	return AABB(model.boundsMin, model.boundsMax);
+}
 
-	return Sphere((maxAABB + minAABB) * 0.5f, glm::length(minAABB - maxAABB));
+Sphere generateSphereBV(const Model& model)
+{
+	return Sphere((model.boundsMax + model.boundsMin) * 0.5f, glm::length(model.boundsMin - model.boundsMax));
 }
 
 class Entity
@@ -471,7 +483,7 @@ public:
 		if (boundingVolume->isOnFrustum(frustum, transform))
 		{
 			ourShader.setMat4("model", transform.getModelMatrix());
-			pModel->Draw(ourShader);
+			pModel->Draw();
 			display++;
 		}
 		total++;
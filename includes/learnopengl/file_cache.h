@@ -0,0 +1,171 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 64-bit FNV-1a, pass the previous result as hash to continue hashing more data
+inline uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline std::string HashToString(uint64_t hash)
+{
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+    return text;
+}
+
+// read-only memory mapping of a whole file, the mapping lives as long as the object
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            return;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping)
+            return;
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (bytes)
+            length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0)
+            return;
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+            return;
+        void *address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address == MAP_FAILED)
+            return;
+        bytes = static_cast<const unsigned char*>(address);
+        length = static_cast<size_t>(status.st_size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (bytes)
+            munmap(const_cast<unsigned char*>(bytes), length);
+        if (descriptor >= 0)
+            close(descriptor);
+#endif
+    }
+
+    bool isOpen() const { return bytes != nullptr; }
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int descriptor = -1;
+#endif
+};
+
+// identifies one version of a source file, cache entries store it to notice when their source changed
+struct FileStamp
+{
+    uint64_t size = 0;
+    int64_t modified = 0;
+    uint64_t contentHash = 0;
+
+    bool operator==(const FileStamp &other) const
+    {
+        return size == other.size && modified == other.modified && contentHash == other.contentHash;
+    }
+};
+
+// fills in size and modification time, and the content hash when hashContents is set
+inline bool GetFileStamp(const std::string &path, FileStamp &stamp, bool hashContents = true)
+{
+    std::error_code error;
+    stamp.size = static_cast<uint64_t>(std::filesystem::file_size(path, error));
+    if (error)
+        return false;
+    stamp.modified = static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+    if (error)
+        return false;
+    stamp.contentHash = 0;
+    if (hashContents)
+    {
+        MappedFile source(path);
+        if (!source.isOpen())
+            return false;
+        stamp.contentHash = HashBytes(source.data(), source.size());
+    }
+    return true;
+}
+
+// writes to a temporary file first and renames it, so readers never see a half written cache entry
+inline bool WriteFileAtomically(const std::string &path, const void *data, size_t size)
+{
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!file)
+            return false;
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+#endif
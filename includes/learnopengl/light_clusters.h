@@ -0,0 +1,255 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/texture_units.h>
+#include <learnopengl/thread_pool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+// the view frustum is split into CLUSTER_X x CLUSTER_Y tiles on screen and CLUSTER_Z slices in depth, the slices
+// spaced exponentially so the clusters stay roughly cubic. the shaders get the same numbers from LightClusters::defines().
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+// a lamp, ceiling spot or the like. lights up to radius units around it, fading out towards there, and casts no shadow.
+struct PointLight {
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+// sorts the point lights into the clusters of the camera every frame and keeps the result in three buffer textures
+// for clustered_lights.glsl: the lights, per cluster the range of its entries in the light index list, and that
+// list. a fragment then only loops over the lights of its own cluster, however many the room has. the clusters are
+// filled a range of depth slices per thread, each thread writing only its own clusters. GL thread only, except for
+// the workers of the pool.
+class LightClusters
+{
+public:
+    // the assignment runs on pool's workers next to the calling thread, or on the calling thread alone without one
+    explicit LightClusters(ThreadPool *pool = nullptr) : pool(pool), grid(CLUSTER_COUNT), bounds(CLUSTER_COUNT)
+    {
+        const GLenum formats[BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        glGenBuffers(BUFFER_COUNT, buffers);
+        glGenTextures(BUFFER_COUNT, textures);
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // the grid size for the shaders, pass it along with the other defines of a program
+    static std::string defines()
+    {
+        return "#define CLUSTER_X " + std::to_string(CLUSTER_X) + "\n#define CLUSTER_Y " + std::to_string(CLUSTER_Y) +
+            "\n#define CLUSTER_Z " + std::to_string(CLUSTER_Z) + "\n";
+    }
+
+    // lays the clusters into the frustum of a perspective projection, only recomputed when it changes. fovy in radians.
+    void setProjection(float fovy, float aspect, float nearPlane, float farPlane, const glm::vec2 &screenSize)
+    {
+        const glm::vec4 projection(fovy, aspect, nearPlane, farPlane);
+        if (projection == currentProjection && screenSize == this->screenSize)
+            return;
+        currentProjection = projection;
+        this->screenSize = screenSize;
+        sliceScale = CLUSTER_Z / std::log(farPlane / nearPlane);
+        sliceBias = -CLUSTER_Z * std::log(nearPlane) / std::log(farPlane / nearPlane);
+
+        // view space bounds of each cluster, the corners of its tile at the near and far depth of its slice
+        const float tanHalf = std::tan(fovy * 0.5f);
+        for (int slice = 0; slice <= CLUSTER_Z; slice++)
+            sliceDepths[slice] = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(slice) / CLUSTER_Z);
+        for (int slice = 0; slice < CLUSTER_Z; slice++)
+            for (int y = 0; y < CLUSTER_Y; y++)
+                for (int x = 0; x < CLUSTER_X; x++)
+                {
+                    glm::vec3 boxMin(1e30f), boxMax(-1e30f);
+                    for (int corner = 0; corner < 8; corner++)
+                    {
+                        float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / CLUSTER_X;
+                        float ndcY = -1.0f + 2.0f * (y + ((corner >> 1) & 1)) / CLUSTER_Y;
+                        float depth = sliceDepths[slice + ((corner >> 2) & 1)];
+                        glm::vec3 point(ndcX * depth * tanHalf * aspect, ndcY * depth * tanHalf, -depth);
+                        boxMin = glm::min(boxMin, point);
+                        boxMax = glm::max(boxMax, point);
+                    }
+                    bounds[clusterIndex(x, y, slice)] = { boxMin, boxMax };
+                }
+    }
+
+    // assigns the lights, in world space, to the clusters of the camera with the given view matrix and uploads the result
+    void update(const std::vector<PointLight> &lights, const glm::mat4 &view)
+    {
+        auto start = std::chrono::steady_clock::now();
+        viewLights.resize(lights.size());
+        lightTexels.resize(std::max<size_t>(lights.size() * 2, 1));
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            viewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(lights[i].position, 1.0f)), lights[i].radius);
+            lightTexels[i * 2] = glm::vec4(lights[i].position, lights[i].radius);
+            lightTexels[i * 2 + 1] = glm::vec4(lights[i].color * lights[i].intensity, 0.0f);
+        }
+
+        // a few slices per thread, the calling thread takes the first range
+        const unsigned int chunkCount = std::min<unsigned int>(CLUSTER_Z, pool && !lights.empty() ? pool->size() + 1 : 1);
+        chunks.resize(chunkCount);
+        for (unsigned int i = 0; i < chunkCount; i++)
+        {
+            chunks[i].firstSlice = CLUSTER_Z * i / chunkCount;
+            chunks[i].endSlice = CLUSTER_Z * (i + 1) / chunkCount;
+        }
+        std::vector<std::future<void>> pending;
+        for (unsigned int i = 1; i < chunkCount; i++)
+            pending.push_back(pool->enqueue([this, i] { assignSlices(chunks[i]); }));
+        assignSlices(chunks[0]);
+        for (std::future<void> &chunk : pending)
+            chunk.get();
+
+        // the chunks cover consecutive clusters, so their lists only have to be concatenated
+        indices.clear();
+        maxLightsPerCluster = 0;
+        for (Chunk &chunk : chunks)
+        {
+            const uint32_t base = static_cast<uint32_t>(indices.size());
+            for (size_t cluster = clusterIndex(0, 0, chunk.firstSlice); cluster < clusterIndex(0, 0, chunk.endSlice); cluster++)
+            {
+                grid[cluster].x += base;
+                maxLightsPerCluster = std::max(maxLightsPerCluster, grid[cluster].y);
+            }
+            indices.insert(indices.end(), chunk.indices.begin(), chunk.indices.end());
+        }
+        if (indices.empty())
+            indices.push_back(0);
+
+        upload(0, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+        upload(1, grid.data(), grid.size() * sizeof(glm::uvec2));
+        upload(2, indices.data(), indices.size() * sizeof(uint32_t));
+        lightCount = static_cast<unsigned int>(lights.size());
+        assignMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // binds the buffer textures to their units, see texture_units.h
+    void bind() const
+    {
+        const int units[BUFFER_COUNT] = { LIGHT_DATA_TEXTURE_UNIT, CLUSTER_GRID_TEXTURE_UNIT, CLUSTER_LIGHTS_TEXTURE_UNIT };
+        for (int i = 0; i < BUFFER_COUNT; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // slice = floor(log(view depth) * sliceScale + sliceBias) and the tile size in pixels, for the frame's uniforms
+    float getSliceScale() const { return sliceScale; }
+    float getSliceBias() const { return sliceBias; }
+    glm::vec2 getTileSize() const { return screenSize / glm::vec2(CLUSTER_X, CLUSTER_Y); }
+
+    // what the last update() produced
+    unsigned int getLightCount() const { return lightCount; }
+    unsigned int getMaxLightsPerCluster() const { return maxLightsPerCluster; }
+    size_t getIndexCount() const { return indices.size(); }
+    float getAssignMilliseconds() const { return assignMilliseconds; }
+
+private:
+    static const int BUFFER_COUNT = 3;
+
+    struct Box {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+    // the clusters of the depth slices [firstSlice, endSlice) and their light indices, grid offsets relative to them
+    struct Chunk {
+        int firstSlice = 0;
+        int endSlice = 0;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> candidates;
+    };
+
+    ThreadPool *pool;
+    GLuint buffers[BUFFER_COUNT];
+    GLuint textures[BUFFER_COUNT];
+    glm::vec4 currentProjection = glm::vec4(0.0f);
+    glm::vec2 screenSize = glm::vec2(0.0f);
+    float sliceScale = 0.0f;
+    float sliceBias = 0.0f;
+    float sliceDepths[CLUSTER_Z + 1] = {};
+    std::vector<glm::uvec2> grid;   // per cluster: first index and count
+    std::vector<Box> bounds;        // per cluster, view space
+    std::vector<glm::vec4> viewLights; // view space center and radius
+    std::vector<glm::vec4> lightTexels;
+    std::vector<uint32_t> indices;
+    std::vector<Chunk> chunks;
+    unsigned int lightCount = 0;
+    unsigned int maxLightsPerCluster = 0;
+    float assignMilliseconds = 0.0f;
+
+    static size_t clusterIndex(int x, int y, int slice)
+    {
+        return (static_cast<size_t>(slice) * CLUSTER_Y + y) * CLUSTER_X + x;
+    }
+
+    // runs on a worker: tests the lights reaching into each slice against the clusters of that slice
+    void assignSlices(Chunk &chunk)
+    {
+        chunk.indices.clear();
+        for (int slice = chunk.firstSlice; slice < chunk.endSlice; slice++)
+        {
+            chunk.candidates.clear();
+            for (uint32_t i = 0; i < viewLights.size(); i++)
+            {
+                float depth = -viewLights[i].z, radius = viewLights[i].w;
+                if (depth + radius >= sliceDepths[slice] && depth - radius <= sliceDepths[slice + 1])
+                    chunk.candidates.push_back(i);
+            }
+            for (int y = 0; y < CLUSTER_Y; y++)
+                for (int x = 0; x < CLUSTER_X; x++)
+                {
+                    const size_t cluster = clusterIndex(x, y, slice);
+                    const Box &box = bounds[cluster];
+                    grid[cluster] = glm::uvec2(static_cast<uint32_t>(chunk.indices.size()), 0);
+                    for (uint32_t i : chunk.candidates)
+                    {
+                        // distance from the sphere's center to the box
+                        glm::vec3 center(viewLights[i]);
+                        glm::vec3 outside = glm::max(glm::max(box.min - center, center - box.max), glm::vec3(0.0f));
+                        if (glm::dot(outside, outside) > viewLights[i].w * viewLights[i].w)
+                            continue;
+                        chunk.indices.push_back(i);
+                        grid[cluster].y++;
+                    }
+                }
+        }
+    }
+
+    // replaces the contents of buffer, orphaning the storage the previous frame may still read
+    void upload(int buffer, const void *data, size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+        glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+#endif
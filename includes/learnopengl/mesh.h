@@ -5,14 +5,26 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <learnopengl/shader.h>
+#include <learnopengl/texture_units.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <string>
 #include <vector>
 using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
+// the per instance model matrix takes the four attribute locations starting here, one per column,
+// followed by the three columns of its normal matrix
+#define INSTANCE_MATRIX_LOCATION 7
+#define INSTANCE_NORMAL_MATRIX_LOCATION 11
+// detail levels a mesh can have, level 0 is the mesh as imported
+#define MESH_MAX_LODS 4
 
 struct Vertex {
     // position
@@ -31,9 +43,128 @@ struct Vertex {
 	float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// layouts a mesh can be uploaded with. static meshes only carry what model_vertex.vert reads and
+// store it packed, the full Vertex above is uploaded as it is for skinned meshes.
+enum VertexFormat {
+    VERTEX_FORMAT_STATIC,          // position, octahedral normal, half float uv
+    VERTEX_FORMAT_STATIC_TANGENT,  // the above plus a packed tangent for normal mapped meshes
+    VERTEX_FORMAT_SKINNED          // Vertex
+};
+
+// 20 bytes
+struct StaticVertex {
+    glm::vec3 Position;
+    glm::uint32 Normal;     // octahedral encoding, two snorm16
+    glm::uint32 TexCoords;  // two half floats
+};
+
+// 24 bytes
+struct StaticTangentVertex {
+    glm::vec3 Position;
+    glm::uint32 Normal;
+    glm::uint32 TexCoords;
+    glm::uint32 Tangent;    // snorm 10/10/10/2, the sign of w is the handedness of the bitangent
+};
+
+inline size_t VertexFormatSize(VertexFormat format)
+{
+    if (format == VERTEX_FORMAT_STATIC)
+        return sizeof(StaticVertex);
+    if (format == VERTEX_FORMAT_STATIC_TANGENT)
+        return sizeof(StaticTangentVertex);
+    return sizeof(Vertex);
+}
+
+// maps a unit vector onto the octahedron and unfolds it into [-1, 1]^2, decoded again in the vertex shader
+inline glm::vec2 OctahedralEncode(glm::vec3 n)
+{
+    float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (length == 0.0f)
+        return glm::vec2(0.0f);
+    n /= length;
+    if (n.z >= 0.0f)
+        return glm::vec2(n.x, n.y);
+    return glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                     (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+}
+
+// converts vertices into the GPU layout of format, out must hold count * VertexFormatSize(format) bytes
+inline void PackVertices(VertexFormat format, const Vertex *vertices, size_t count, unsigned char *out)
+{
+    if (format == VERTEX_FORMAT_SKINNED)
+    {
+        std::memcpy(out, vertices, count * sizeof(Vertex));
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        const Vertex &vertex = vertices[i];
+        StaticTangentVertex packed;
+        packed.Position = vertex.Position;
+        packed.Normal = glm::packSnorm2x16(OctahedralEncode(vertex.Normal));
+        packed.TexCoords = glm::packHalf2x16(vertex.TexCoords);
+        if (format == VERTEX_FORMAT_STATIC)
+        {
+            std::memcpy(out + i * sizeof(StaticVertex), &packed, sizeof(StaticVertex));
+            continue;
+        }
+        glm::vec3 tangent = glm::dot(vertex.Tangent, vertex.Tangent) > 0.0f ? glm::normalize(vertex.Tangent) : glm::vec3(1.0f, 0.0f, 0.0f);
+        float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+        packed.Tangent = glm::packSnorm3x10_1x2(glm::vec4(tangent, handedness));
+        std::memcpy(out + i * sizeof(StaticTangentVertex), &packed, sizeof(StaticTangentVertex));
+    }
+}
+
+// what the instance buffer holds per instance. the normal matrix is computed once per instance on the CPU
+// instead of inverting the model matrix for every vertex.
+struct InstanceData {
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+
+    InstanceData() = default;
+    explicit InstanceData(const glm::mat4 &model)
+        : model(model), normalMatrix(glm::transpose(glm::inverse(glm::mat3(model)))) {}
+};
+
+// sources the instance matrices of the bound VAO from buffer, advancing once per instance. GL 3.3 has no base
+// instance, so draws of a range of the buffer start at firstInstance by offsetting the pointers instead.
+inline void SetupInstanceAttributes(unsigned int buffer, unsigned int firstInstance = 0)
+{
+    const size_t base = firstInstance * sizeof(InstanceData);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (unsigned int column = 0; column < 4; column++)
+    {
+        glEnableVertexAttribArray(INSTANCE_MATRIX_LOCATION + column);
+        glVertexAttribPointer(INSTANCE_MATRIX_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(INSTANCE_MATRIX_LOCATION + column, 1);
+    }
+    for (unsigned int column = 0; column < 3; column++)
+    {
+        glEnableVertexAttribArray(INSTANCE_NORMAL_MATRIX_LOCATION + column);
+        glVertexAttribPointer(INSTANCE_NORMAL_MATRIX_LOCATION + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, normalMatrix) + column * sizeof(glm::vec3)));
+        glVertexAttribDivisor(INSTANCE_NORMAL_MATRIX_LOCATION + column, 1);
+    }
+}
+
+// sets the instance matrices seen by VAOs without an instance buffer (e.g. the walls), they are constant attributes then
+inline void SetInstanceMatrix(const glm::mat4 &matrix)
+{
+    InstanceData instance(matrix);
+    for (unsigned int column = 0; column < 4; column++)
+        glVertexAttrib4fv(INSTANCE_MATRIX_LOCATION + column, &instance.model[column][0]);
+    for (unsigned int column = 0; column < 3; column++)
+        glVertexAttrib3fv(INSTANCE_NORMAL_MATRIX_LOCATION + column, &instance.normalMatrix[column][0]);
+}
+
+// a detail level of a mesh, a range of its index buffer. the coarser levels are stored after level 0.
+struct MeshLod {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+};
+
 struct Texture {
     unsigned int id;
-    string type;
+    TextureType type;
     string path;
 };
 
@@ -43,60 +174,98 @@ public:
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    VertexFormat format;
     unsigned int VAO;
+    // unit each texture is bound to, same order as textures, -1 for textures no sampler reads
+    vector<int> textureUnits;
+    // detail levels from fine to coarse, indexCount covers all of them
+    vector<MeshLod> lods;
 
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor, pass setup = false when constructing off the GL thread and call setupMesh() there later.
+    // the vertices are kept in full on the CPU and converted to format when they are uploaded.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool setup = true, VertexFormat format = VERTEX_FORMAT_SKINNED)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->vertexCount = static_cast<unsigned int>(this->vertices.size());
+        this->indexCount = static_cast<unsigned int>(this->indices.size());
+        this->format = format;
+        this->lods.push_back({ 0, this->indexCount });
+        assignTextureUnits();
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        if (setup)
+            setupMesh();
+    }
+
+    // constructor for mesh data that lives in memory owned by someone else (e.g. a mapped cache file).
+    // vertices are already in the layout of format and uploaded straight from there, so the data has to stay
+    // valid until setupMesh() has run. such meshes have no CPU side vertices.
+    // lods defaults to a single level over all indices.
+    Mesh(VertexFormat format, const void *vertices, unsigned int vertexCount, const unsigned int *indices, unsigned int indexCount, vector<Texture> textures, bool setup = true, vector<MeshLod> lods = vector<MeshLod>())
+    {
+        this->mappedVertices = static_cast<const unsigned char*>(vertices);
+        this->mappedIndices = indices;
+        this->vertexCount = vertexCount;
+        this->indexCount = indexCount;
+        this->textures = textures;
+        this->format = format;
+        this->lods = lods.empty() ? vector<MeshLod>(1, MeshLod{ 0, indexCount }) : lods;
+        assignTextureUnits();
+
+        if (setup)
+            setupMesh();
+    }
+
+    // the range of detail level, clamped to the coarsest level the mesh has
+    const MeshLod &lod(size_t level) const
+    {
+        return lods[std::min(level, lods.size() - 1)];
     }
 
-    // render the mesh
-    void Draw(Shader &shader) 
+    // render the mesh, once per instance in the instance buffer set with setInstanceBuffer().
+    // the samplers were pointed at their units when the program was linked, so this only binds textures.
+    void Draw(unsigned int instanceCount = 1) const
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-             else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
+            if (textureUnits[i] < 0)
+                continue;
+            glActiveTexture(GL_TEXTURE0 + textureUnits[i]);
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
         
         // draw mesh
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+        useInstanceRange(0);
+        glDrawElementsInstanced(GL_TRIANGLES, lods[0].indexCount, GL_UNSIGNED_INT, (void*)(lods[0].indexOffset * sizeof(unsigned int)), instanceCount);
         glBindVertexArray(0);
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    // render data 
-    unsigned int VBO, EBO;
+    // makes the VAO read its per instance model matrices from buffer
+    void setInstanceBuffer(unsigned int buffer)
+    {
+        instanceBuffer = buffer;
+        instanceBase = 0;
+        glBindVertexArray(VAO);
+        SetupInstanceAttributes(buffer);
+        glBindVertexArray(0);
+    }
+
+    // with the VAO bound, makes the next draw start at instance firstInstance of the instance buffer
+    void useInstanceRange(unsigned int firstInstance) const
+    {
+        if (firstInstance == instanceBase || instanceBuffer == 0)
+            return;
+        instanceBase = firstInstance;
+        SetupInstanceAttributes(instanceBuffer, firstInstance);
+    }
 
     // initializes all the buffer objects/arrays
     void setupMesh()
@@ -112,12 +281,77 @@ private:
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
+        const size_t stride = VertexFormatSize(format);
+        vector<unsigned char> packed;
+        const unsigned char *vertexData = mappedVertices;
+        if (!vertexData)
+        {
+            packed.resize(vertexCount * stride);
+            PackVertices(format, vertices.data(), vertexCount, packed.data());
+            vertexData = packed.data();
+        }
+        const unsigned int *indexData = mappedIndices ? mappedIndices : indices.data();
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * stride, vertexData, GL_STATIC_DRAW);  
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
+        if (format != VERTEX_FORMAT_SKINNED)
+            setupPackedAttributes();
+        else
+            setupFullAttributes();
+        glBindVertexArray(0);
+
+        // borrowed data is only guaranteed to live until the upload
+        mappedVertices = nullptr;
+        mappedIndices = nullptr;
+    }
+
+private:
+    // render data 
+    unsigned int VBO, EBO;
+    unsigned int instanceBuffer = 0;
+    mutable unsigned int instanceBase = 0;
+    const unsigned char *mappedVertices = nullptr;
+    const unsigned int *mappedIndices = nullptr;
+
+    // numbers the textures of each type in order, the n-th one goes to the unit of sampler texture_<type>n
+    void assignTextureUnits()
+    {
+        unsigned int counts[TEXTURE_TYPE_COUNT] = {};
+        textureUnits.resize(textures.size());
+        for (size_t i = 0; i < textures.size(); i++)
+        {
+            TextureType type = textures[i].type;
+            textureUnits[i] = type < TEXTURE_TYPE_COUNT ? MaterialTextureUnit(type, counts[type]++) : -1;
+        }
+    }
+
+    // StaticVertex / StaticTangentVertex, the normal arrives as a normalized vec2 for the shader to unfold
+    void setupPackedAttributes()
+    {
+        const GLsizei stride = static_cast<GLsizei>(VertexFormatSize(format));
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(StaticTangentVertex, Position));
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(StaticTangentVertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(StaticTangentVertex, TexCoords));
+        // vertex tangent, the bitangent is cross(normal, tangent.xyz) * sign(tangent.w)
+        if (format == VERTEX_FORMAT_STATIC_TANGENT)
+        {
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(StaticTangentVertex, Tangent));
+        }
+    }
+
+    // Vertex
+    void setupFullAttributes()
+    {
         // vertex Positions
         glEnableVertexAttribArray(0);	
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -140,7 +374,6 @@ private:
 		// weights
 		glEnableVertexAttribArray(6);
 		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
     }
 };
 #endif
@@ -0,0 +1,262 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <learnopengl/file_cache.h>
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// bump whenever the layout below or the import post-processing changes, old entries are then rebuilt
+#define MESH_CACHE_VERSION 6
+#define MESH_CACHE_MAGIC 0x434D5052 // "RPMC"
+
+// An entry is one flat file: header, mesh table, texture table, string blob and then the vertex and index
+// arrays, each 16 byte aligned. Vertices are stored already packed into the mesh's VertexFormat, so loading
+// maps the file and points the meshes straight into it. The detail levels of a mesh are ranges of its index array.
+struct MeshCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t meshCount;
+    uint64_t sourceSize;
+    int64_t  sourceModified;
+    uint64_t sourceHash;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    float    boundsMin[3];  // object space bounds of all meshes
+    float    boundsMax[3];
+    uint32_t lodCount;      // detail levels of every mesh
+    float    lodErrors[MESH_MAX_LODS];  // object space error of each level
+};
+
+struct MeshCacheMesh {
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t textureOffset; // index of the first MeshCacheTexture of this mesh
+    uint32_t textureCount;
+    uint32_t vertexFormat;
+    uint32_t vertexStride;  // VertexFormatSize(vertexFormat) when the entry was written
+    uint32_t lodIndexOffset[MESH_MAX_LODS];  // in indices from indexOffset
+    uint32_t lodIndexCount[MESH_MAX_LODS];
+};
+
+struct MeshCacheTexture {
+    uint32_t typeOffset;
+    uint32_t typeLength;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+class MeshCache
+{
+public:
+    // folder holding the cache entries, relative to the working directory unless made absolute
+    static std::string &directory()
+    {
+        static std::string cacheDirectory = "cache/meshes";
+        return cacheDirectory;
+    }
+
+    static std::string entryPath(const std::string &sourcePath)
+    {
+        return directory() + "/" + HashToString(HashBytes(sourcePath.data(), sourcePath.size())) + ".mesh";
+    }
+
+    // fills meshes, their bounds and the errors of their detail levels from the cache entry of sourcePath if there is
+    // an up to date one. the meshes reference the mapped file, which is handed out through mapping and has to outlive
+    // their setupMesh() call.
+    static bool load(const std::string &sourcePath, vector<Mesh> &meshes, glm::vec3 &boundsMin, glm::vec3 &boundsMax,
+        vector<float> &lodErrors, std::shared_ptr<MappedFile> &mapping, bool setup)
+    {
+        auto file = std::make_shared<MappedFile>(entryPath(sourcePath));
+        if (!file->isOpen() || file->size() < sizeof(MeshCacheHeader))
+            return false;
+
+        const unsigned char *base = file->data();
+        const size_t size = file->size();
+        MeshCacheHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.lodCount == 0 || header.lodCount > MESH_MAX_LODS)
+            return false;
+        if (!inBounds(header.pathOffset, header.pathLength, size) ||
+            std::string(reinterpret_cast<const char*>(base + header.pathOffset), header.pathLength) != sourcePath)
+            return false;
+
+        // compare the cheap parts of the stamp first and only hash the source when they match
+        FileStamp source;
+        if (!GetFileStamp(sourcePath, source, false) || source.size != header.sourceSize || source.modified != header.sourceModified)
+            return false;
+        if (!GetFileStamp(sourcePath, source) || source.contentHash != header.sourceHash)
+            return false;
+
+        const uint64_t meshTableOffset = sizeof(MeshCacheHeader);
+        const uint64_t textureTableOffset = meshTableOffset + uint64_t(header.meshCount) * sizeof(MeshCacheMesh);
+        if (!inBounds(meshTableOffset, uint64_t(header.meshCount) * sizeof(MeshCacheMesh), size))
+            return false;
+
+        vector<Mesh> cachedMeshes;
+        cachedMeshes.reserve(header.meshCount);
+        for (uint32_t i = 0; i < header.meshCount; i++)
+        {
+            MeshCacheMesh entry;
+            std::memcpy(&entry, base + meshTableOffset + i * sizeof(MeshCacheMesh), sizeof(entry));
+            if (entry.vertexFormat > VERTEX_FORMAT_SKINNED || entry.vertexStride != VertexFormatSize(static_cast<VertexFormat>(entry.vertexFormat)))
+                return false;
+            if (!inBounds(entry.vertexOffset, uint64_t(entry.vertexCount) * entry.vertexStride, size) ||
+                !inBounds(entry.indexOffset, uint64_t(entry.indexCount) * sizeof(unsigned int), size) ||
+                !inBounds(textureTableOffset + uint64_t(entry.textureOffset) * sizeof(MeshCacheTexture), uint64_t(entry.textureCount) * sizeof(MeshCacheTexture), size))
+                return false;
+            vector<MeshLod> lods;
+            for (uint32_t lod = 0; lod < header.lodCount; lod++)
+            {
+                if (uint64_t(entry.lodIndexOffset[lod]) + entry.lodIndexCount[lod] > entry.indexCount)
+                    return false;
+                lods.push_back({ entry.lodIndexOffset[lod], entry.lodIndexCount[lod] });
+            }
+
+            vector<Texture> textures;
+            for (uint32_t t = 0; t < entry.textureCount; t++)
+            {
+                MeshCacheTexture record;
+                std::memcpy(&record, base + textureTableOffset + (uint64_t(entry.textureOffset) + t) * sizeof(MeshCacheTexture), sizeof(record));
+                if (!inBounds(record.typeOffset, record.typeLength, size) || !inBounds(record.pathOffset, record.pathLength, size))
+                    return false;
+                Texture texture;
+                texture.id = 0;
+                if (!TextureTypeFromName(std::string_view(reinterpret_cast<const char*>(base + record.typeOffset), record.typeLength), texture.type))
+                    return false;
+                texture.path.assign(reinterpret_cast<const char*>(base + record.pathOffset), record.pathLength);
+                textures.push_back(texture);
+            }
+
+            cachedMeshes.emplace_back(static_cast<VertexFormat>(entry.vertexFormat), base + entry.vertexOffset, entry.vertexCount,
+                reinterpret_cast<const unsigned int*>(base + entry.indexOffset), entry.indexCount, textures, setup, lods);
+        }
+
+        meshes = std::move(cachedMeshes);
+        boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+        boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+        lodErrors.assign(header.lodErrors, header.lodErrors + header.lodCount);
+        mapping = file;
+        return true;
+    }
+
+    // writes the cache entry of sourcePath, the meshes must still hold their CPU side vertex/index vectors
+    static bool store(const std::string &sourcePath, const vector<Mesh> &meshes, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+        const vector<float> &lodErrors)
+    {
+        MeshCacheHeader header = {};
+        FileStamp source;
+        if (!GetFileStamp(sourcePath, source))
+            return false;
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.meshCount = static_cast<uint32_t>(meshes.size());
+        header.sourceSize = source.size;
+        header.sourceModified = source.modified;
+        header.sourceHash = source.contentHash;
+        for (int i = 0; i < 3; i++)
+        {
+            header.boundsMin[i] = boundsMin[i];
+            header.boundsMax[i] = boundsMax[i];
+        }
+        header.lodCount = static_cast<uint32_t>(std::min<size_t>(lodErrors.size(), MESH_MAX_LODS));
+        for (uint32_t lod = 0; lod < header.lodCount; lod++)
+            header.lodErrors[lod] = lodErrors[lod];
+
+        // lay out the tables and the string blob first, the arrays follow at aligned offsets
+        vector<MeshCacheMesh> meshTable(meshes.size());
+        vector<MeshCacheTexture> textureTable;
+        std::string strings;
+        const uint64_t textureTableOffset = sizeof(MeshCacheHeader) + meshTable.size() * sizeof(MeshCacheMesh);
+        // string offsets are collected relative to the blob and made absolute once its position is known
+        auto addString = [&strings](const std::string &text, uint32_t &length) {
+            uint32_t relative = static_cast<uint32_t>(strings.size());
+            length = static_cast<uint32_t>(text.size());
+            strings += text;
+            return relative;
+        };
+
+        vector<uint32_t> relativeOffsets;
+        uint32_t pathRelative = addString(sourcePath, header.pathLength);
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshTable[i].textureOffset = static_cast<uint32_t>(textureTable.size());
+            meshTable[i].textureCount = static_cast<uint32_t>(meshes[i].textures.size());
+            for (const Texture &texture : meshes[i].textures)
+            {
+                MeshCacheTexture record;
+                relativeOffsets.push_back(addString(TextureTypeName(texture.type), record.typeLength));
+                relativeOffsets.push_back(addString(texture.path, record.pathLength));
+                textureTable.push_back(record);
+            }
+        }
+
+        const uint64_t blobOffset = textureTableOffset + textureTable.size() * sizeof(MeshCacheTexture);
+        header.pathOffset = static_cast<uint32_t>(blobOffset + pathRelative);
+        for (size_t i = 0; i < textureTable.size(); i++)
+        {
+            textureTable[i].typeOffset = static_cast<uint32_t>(blobOffset + relativeOffsets[2 * i]);
+            textureTable[i].pathOffset = static_cast<uint32_t>(blobOffset + relativeOffsets[2 * i + 1]);
+        }
+
+        uint64_t offset = align(blobOffset + strings.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshTable[i].vertexCount = static_cast<uint32_t>(meshes[i].vertices.size());
+            meshTable[i].indexCount = static_cast<uint32_t>(meshes[i].indices.size());
+            meshTable[i].vertexFormat = meshes[i].format;
+            meshTable[i].vertexStride = static_cast<uint32_t>(VertexFormatSize(meshes[i].format));
+            for (uint32_t lod = 0; lod < header.lodCount; lod++)
+            {
+                meshTable[i].lodIndexOffset[lod] = meshes[i].lod(lod).indexOffset;
+                meshTable[i].lodIndexCount[lod] = meshes[i].lod(lod).indexCount;
+            }
+            meshTable[i].vertexOffset = offset;
+            offset = align(offset + meshes[i].vertices.size() * meshTable[i].vertexStride);
+            meshTable[i].indexOffset = offset;
+            offset = align(offset + meshes[i].indices.size() * sizeof(unsigned int));
+        }
+
+        vector<unsigned char> buffer(static_cast<size_t>(offset), 0);
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        if (!meshTable.empty())
+            std::memcpy(buffer.data() + sizeof(header), meshTable.data(), meshTable.size() * sizeof(MeshCacheMesh));
+        if (!textureTable.empty())
+            std::memcpy(buffer.data() + textureTableOffset, textureTable.data(), textureTable.size() * sizeof(MeshCacheTexture));
+        std::memcpy(buffer.data() + blobOffset, strings.data(), strings.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            if (!meshes[i].vertices.empty())
+                PackVertices(meshes[i].format, meshes[i].vertices.data(), meshes[i].vertices.size(), buffer.data() + meshTable[i].vertexOffset);
+            if (!meshes[i].indices.empty())
+                std::memcpy(buffer.data() + meshTable[i].indexOffset, meshes[i].indices.data(), meshes[i].indices.size() * sizeof(unsigned int));
+        }
+
+        if (!WriteFileAtomically(entryPath(sourcePath), buffer.data(), buffer.size()))
+        {
+            std::cout << "ERROR::MESH_CACHE:: could not write cache entry for " << sourcePath << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    static bool inBounds(uint64_t offset, uint64_t length, size_t size)
+    {
+        return offset <= size && length <= size - offset;
+    }
+};
+#endif
@@ -0,0 +1,331 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/file_cache.h>
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// cache sizes used for optimizing (LRU, as in Forsyth's paper) and for measuring (FIFO, closer to real hardware)
+#define MESH_OPTIMIZER_CACHE_SIZE 32
+#define MESH_OPTIMIZER_FIFO_SIZE 16
+
+// post-transform cache behaviour of an index buffer
+struct VertexCacheStats {
+    size_t triangles = 0;
+    size_t vertices = 0;      // unique vertices referenced
+    size_t transformed = 0;   // cache misses of a simulated FIFO cache
+
+    // average cache miss ratio, transformed vertices per triangle. 0.5 is the ideal for a regular grid, 3 the worst
+    float acmr() const { return triangles ? float(transformed) / triangles : 0.0f; }
+    // average transform to vertex ratio, 1 means every vertex is transformed exactly once
+    float atvr() const { return vertices ? float(transformed) / vertices : 0.0f; }
+
+    VertexCacheStats &operator+=(const VertexCacheStats &other)
+    {
+        triangles += other.triangles;
+        vertices += other.vertices;
+        transformed += other.transformed;
+        return *this;
+    }
+};
+
+struct MeshOptimizerStats {
+    VertexCacheStats before;
+    VertexCacheStats after;
+
+    MeshOptimizerStats &operator+=(const MeshOptimizerStats &other)
+    {
+        before += other.before;
+        after += other.after;
+        return *this;
+    }
+};
+
+// simulates a FIFO post-transform cache over the index buffer
+inline VertexCacheStats AnalyzeVertexCache(const vector<unsigned int> &indices, size_t vertexCount)
+{
+    VertexCacheStats stats;
+    stats.triangles = indices.size() / 3;
+
+    // timestamps instead of an actual queue: a vertex is cached while it was inserted less than FIFO_SIZE misses ago
+    vector<size_t> insertedAt(vertexCount, 0);
+    vector<bool> referenced(vertexCount, false);
+    for (unsigned int index : indices)
+    {
+        if (!referenced[index])
+        {
+            referenced[index] = true;
+            stats.vertices++;
+        }
+        if (insertedAt[index] == 0 || stats.transformed - insertedAt[index] + 1 > MESH_OPTIMIZER_FIFO_SIZE)
+        {
+            stats.transformed++;
+            insertedAt[index] = stats.transformed;
+        }
+    }
+    return stats;
+}
+
+// merges vertices that end up bitwise identical once packed into format, so the weld ignores attributes the GPU
+// never sees (e.g. tangents of a static mesh) and precision it would lose anyway. returns the new vertex count.
+inline size_t WeldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices, VertexFormat format)
+{
+    const size_t stride = VertexFormatSize(format);
+    vector<unsigned char> packed(vertices.size() * stride);
+    PackVertices(format, vertices.data(), vertices.size(), packed.data());
+
+    vector<unsigned int> remap(vertices.size());
+    vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    std::unordered_map<uint64_t, vector<unsigned int>> buckets; // hash of the packed vertex -> welded vertices
+    buckets.reserve(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        const unsigned char *key = packed.data() + i * stride;
+        vector<unsigned int> &bucket = buckets[HashBytes(key, stride)];
+        unsigned int target = static_cast<unsigned int>(welded.size());
+        for (unsigned int candidate : bucket)
+        {
+            if (std::memcmp(packed.data() + candidate * stride, key, stride) == 0)
+            {
+                target = candidate;
+                break;
+            }
+        }
+        if (target == welded.size())
+        {
+            // keep the packed copy of a welded vertex where later duplicates are compared against it
+            std::memmove(packed.data() + target * stride, key, stride);
+            bucket.push_back(target);
+            welded.push_back(vertices[i]);
+        }
+        remap[i] = target;
+    }
+
+    for (unsigned int &index : indices)
+        index = remap[index];
+    vertices.swap(welded);
+    return vertices.size();
+}
+
+// reorders the triangles for post-transform cache reuse using Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+inline void OptimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles using each vertex
+    vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        adjacencyOffset[index + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyOffset[v + 1] += adjacencyOffset[v];
+    vector<unsigned int> adjacency(indices.size());
+    vector<unsigned int> remaining(vertexCount, 0); // triangles not yet emitted, per vertex
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = indices[t * 3 + k];
+            adjacency[adjacencyOffset[v] + remaining[v]++] = static_cast<unsigned int>(t);
+        }
+    }
+
+    auto vertexScore = [](int cachePosition, unsigned int valence) {
+        if (valence == 0)
+            return -1.0f; // nothing left to draw with it
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // the last triangle's vertices score the same no matter in which order they were used
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - float(cachePosition - 3) / (MESH_OPTIMIZER_CACHE_SIZE - 3), 1.5f);
+        }
+        // favour vertices with few triangles left, so lone triangles don't get stranded
+        return score + 2.0f / std::sqrt(float(valence));
+    };
+
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+    vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+    vector<bool> emitted(triangleCount, false);
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    vector<unsigned int> cache, nextCache;
+    cache.reserve(MESH_OPTIMIZER_CACHE_SIZE + 3);
+    nextCache.reserve(MESH_OPTIMIZER_CACHE_SIZE + 3);
+
+    size_t fallback = 0; // next triangle in input order to try when nothing in the cache is usable
+    long best = 0;
+    while (best >= 0)
+    {
+        emitted[best] = true;
+        const unsigned int *triangle = &indices[best * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+
+        // the emitted vertices move to the front of the LRU cache
+        nextCache.assign(triangle, triangle + 3);
+        for (unsigned int v : cache)
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = triangle[k];
+            unsigned int *begin = adjacency.data() + adjacencyOffset[v];
+            remaining[v] = static_cast<unsigned int>(std::remove(begin, begin + remaining[v], static_cast<unsigned int>(best)) - begin);
+        }
+
+        // rescore what is in the cache (and what just dropped out of it) and pick the best triangle touching it
+        best = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            unsigned int v = nextCache[i];
+            cachePosition[v] = i < MESH_OPTIMIZER_CACHE_SIZE ? static_cast<int>(i) : -1;
+            float newScore = vertexScore(cachePosition[v], remaining[v]);
+            float delta = newScore - score[v];
+            score[v] = newScore;
+            for (unsigned int a = adjacencyOffset[v]; a < adjacencyOffset[v] + remaining[v]; a++)
+            {
+                unsigned int t = adjacency[a];
+                triangleScore[t] += delta;
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (nextCache.size() > MESH_OPTIMIZER_CACHE_SIZE)
+            nextCache.resize(MESH_OPTIMIZER_CACHE_SIZE);
+        cache.swap(nextCache);
+
+        if (best < 0)
+        {
+            while (fallback < triangleCount && emitted[fallback])
+                fallback++;
+            if (fallback < triangleCount)
+                best = static_cast<long>(fallback);
+        }
+    }
+    indices.swap(result);
+}
+
+// sorts clusters of the cache optimized triangles so outward facing ones are drawn first and hide what lies behind
+// them. a cluster ends wherever a triangle misses the cache with all three vertices, so the cache order is kept.
+inline void OptimizeOverdraw(const vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    vector<size_t> clusterStart;
+    vector<size_t> insertedAt(vertices.size(), 0);
+    size_t transformed = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = indices[t * 3 + k];
+            if (insertedAt[v] == 0 || transformed - insertedAt[v] + 1 > MESH_OPTIMIZER_FIFO_SIZE)
+            {
+                insertedAt[v] = ++transformed;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3)
+            clusterStart.push_back(t);
+    }
+    clusterStart.push_back(triangleCount);
+
+    glm::vec3 meshCenter(0.0f);
+    for (const Vertex &vertex : vertices)
+        meshCenter += vertex.Position;
+    meshCenter /= float(std::max<size_t>(vertices.size(), 1));
+
+    const size_t clusterCount = clusterStart.size() - 1;
+    vector<float> facing(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+        {
+            const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(cross);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += cross;
+            area += triangleArea;
+        }
+        if (area > 0.0f)
+            center /= area;
+        float normalLength = glm::length(normal);
+        facing[c] = normalLength > 0.0f ? glm::dot(center - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&facing](size_t a, size_t b) { return facing[a] > facing[b]; });
+
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (size_t c : order)
+        result.insert(result.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+    indices.swap(result);
+}
+
+// renumbers the vertices in the order the index buffer first uses them and drops unreferenced ones
+inline void OptimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    const unsigned int unused = ~0u;
+    vector<unsigned int> remap(vertices.size(), unused);
+    vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (unsigned int &index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = static_cast<unsigned int>(ordered.size());
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+}
+
+// the full post-import pass: weld, vertex cache order, optionally overdraw order, then fetch order
+inline MeshOptimizerStats OptimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices, VertexFormat format, bool sortForOverdraw = true)
+{
+    MeshOptimizerStats stats;
+    stats.before = AnalyzeVertexCache(indices, vertices.size());
+
+    WeldVertices(vertices, indices, format);
+    OptimizeVertexCache(indices, vertices.size());
+    if (sortForOverdraw)
+        OptimizeOverdraw(vertices, indices);
+    OptimizeVertexFetch(vertices, indices);
+
+    stats.after = AnalyzeVertexCache(indices, vertices.size());
+    return stats;
+}
+#endif
@@ -0,0 +1,392 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/file_cache.h>
+#include <learnopengl/mesh.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// weighted sum of squared distances to a set of planes as the symmetric matrix of (Garland & Heckbert 1997).
+// weight is the sum of the plane weights, the cost divided by it is the mean squared distance.
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+
+    // plane dot(normal, p) + d = 0, normal of unit length
+    static Quadric plane(const glm::dvec3 &normal, double d, double weight)
+    {
+        Quadric q;
+        q.a00 = weight * normal.x * normal.x; q.a01 = weight * normal.x * normal.y; q.a02 = weight * normal.x * normal.z; q.a03 = weight * normal.x * d;
+        q.a11 = weight * normal.y * normal.y; q.a12 = weight * normal.y * normal.z; q.a13 = weight * normal.y * d;
+        q.a22 = weight * normal.z * normal.z; q.a23 = weight * normal.z * d;
+        q.a33 = weight * d * d;
+        q.weight = weight;
+        return q;
+    }
+
+    Quadric &operator+=(const Quadric &q)
+    {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+        return *this;
+    }
+
+    double evaluate(const glm::dvec3 &p) const
+    {
+        return a00 * p.x * p.x + 2.0 * a01 * p.x * p.y + 2.0 * a02 * p.x * p.z + 2.0 * a03 * p.x
+             + a11 * p.y * p.y + 2.0 * a12 * p.y * p.z + 2.0 * a13 * p.y
+             + a22 * p.z * p.z + 2.0 * a23 * p.z
+             + a33;
+    }
+};
+
+// an index buffer of a simplified mesh and the error of the worst collapse that led there, as a distance
+struct SimplifiedLevel {
+    vector<unsigned int> indices;
+    float error;
+};
+
+// how a position may move during simplification
+enum SimplifyVertexKind : unsigned char {
+    SIMPLIFY_MANIFOLD,  // inside a surface and stored once, moves anywhere
+    SIMPLIFY_BORDER,    // on the open edge of a surface, slides along it
+    SIMPLIFY_SEAM,      // stored twice with different normals or uvs, slides along the seam with both copies
+    SIMPLIFY_LOCKED     // corners, non-manifold spots and anything stored more than twice, never moves
+};
+
+// weight of the planes through border and seam edges relative to the triangle planes
+#define SIMPLIFY_EDGE_WEIGHT 4.0
+
+// simplifies an indexed triangle mesh by collapsing vertices onto a neighbour, cheapest quadric error first. every time
+// the triangle count reaches the next entry of targetTriangleCounts (descending) the current index buffer is recorded.
+// only the indices change, a vertex keeps its position, normal and uv, so the levels share the vertex buffer.
+// the vertices are welded by position to find the surface: a position stored with two normals or uvs lies on a seam,
+// and seams and borders only collapse along themselves, with planes through their edges added to the quadrics so they
+// keep their shape. collapses with an error above maxError are skipped, targets not reached by then are left out unless
+// the mesh still got noticeably smaller, in which case it ends with one level at the count it reached.
+inline vector<SimplifiedLevel> SimplifyMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices,
+    const vector<size_t> &targetTriangleCounts, float maxError)
+{
+    vector<SimplifiedLevel> levels;
+    const size_t vertexCount = vertices.size();
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || targetTriangleCounts.empty())
+        return levels;
+
+    vector<unsigned int> triangles(indices.begin(), indices.begin() + triangleCount * 3);
+    vector<char> alive(triangleCount, 1);
+    vector<vector<unsigned int>> vertexTriangles(vertexCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            vertexTriangles[triangles[t * 3 + k]].push_back(static_cast<unsigned int>(t));
+
+    // weld by position: position[v] is the first vertex with the position of v, copies[p] all vertices sharing it.
+    // everything below that is per position (kind, quadric, version) is indexed by that first vertex.
+    vector<unsigned int> position(vertexCount);
+    vector<vector<unsigned int>> copies(vertexCount);
+    {
+        unordered_map<uint64_t, vector<unsigned int>> buckets;
+        buckets.reserve(vertexCount);
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            vector<unsigned int> &bucket = buckets[HashBytes(&vertices[v].Position, sizeof(glm::vec3))];
+            position[v] = v;
+            for (unsigned int other : bucket)
+                if (vertices[other].Position == vertices[v].Position)
+                {
+                    position[v] = other;
+                    break;
+                }
+            if (position[v] == v)
+                bucket.push_back(v);
+            copies[position[v]].push_back(v);
+        }
+    }
+
+    // an edge is open when no triangle runs along it the other way, in the welded mesh that is a border and in the
+    // unwelded one also a seam
+    vector<SimplifyVertexKind> kind(vertexCount, SIMPLIFY_LOCKED);
+    vector<Quadric> quadrics(vertexCount);
+    {
+        auto edgeKey = [](uint64_t a, uint64_t b) { return (a << 32) | b; };
+        unordered_map<uint64_t, unsigned int> positionEdges, vertexEdges;
+        positionEdges.reserve(triangleCount * 3);
+        vertexEdges.reserve(triangleCount * 3);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+                positionEdges[edgeKey(position[a], position[b])]++;
+                vertexEdges[edgeKey(a, b)]++;
+            }
+        auto count = [](const unordered_map<uint64_t, unsigned int> &edges, uint64_t key) {
+            auto it = edges.find(key);
+            return it == edges.end() ? 0u : it->second;
+        };
+
+        vector<unsigned int> openPositionEdges(vertexCount, 0), openVertexEdges(vertexCount, 0);
+        vector<char> complex(vertexCount, 0);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            glm::dvec3 p0 = vertices[triangles[t * 3]].Position;
+            glm::dvec3 p1 = vertices[triangles[t * 3 + 1]].Position;
+            glm::dvec3 p2 = vertices[triangles[t * 3 + 2]].Position;
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            double area = glm::length(normal);
+            if (area > 0.0)
+            {
+                normal /= area;
+                Quadric q = Quadric::plane(normal, -glm::dot(normal, p0), area * 0.5);
+                for (int k = 0; k < 3; k++)
+                    quadrics[position[triangles[t * 3 + k]]] += q;
+            }
+
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+                unsigned int pa = position[a], pb = position[b];
+                if (pa == pb || count(positionEdges, edgeKey(pa, pb)) > 1 || count(positionEdges, edgeKey(pb, pa)) > 1)
+                {
+                    complex[pa] = complex[pb] = 1;
+                    continue;
+                }
+                if (count(positionEdges, edgeKey(pb, pa)) == 0)
+                    openPositionEdges[pa]++, openPositionEdges[pb]++;
+                if (count(vertexEdges, edgeKey(b, a)) != 0 || area == 0.0)
+                    continue;
+                openVertexEdges[a]++, openVertexEdges[b]++;
+                // a plane through the open edge standing upright on its triangle
+                glm::dvec3 pointA = vertices[a].Position, pointB = vertices[b].Position;
+                glm::dvec3 edge = pointB - pointA;
+                double length = glm::length(edge);
+                if (length == 0.0)
+                    continue;
+                glm::dvec3 edgeNormal = glm::normalize(glm::cross(edge, normal));
+                Quadric q = Quadric::plane(edgeNormal, -glm::dot(edgeNormal, pointA), length * length * SIMPLIFY_EDGE_WEIGHT);
+                quadrics[pa] += q;
+                quadrics[pb] += q;
+            }
+        }
+
+        for (unsigned int p = 0; p < vertexCount; p++)
+        {
+            if (position[p] != p || complex[p])
+                continue;
+            if (copies[p].size() == 1 && openPositionEdges[p] == 0)
+                kind[p] = SIMPLIFY_MANIFOLD;
+            else if (copies[p].size() == 1 && openPositionEdges[p] == 2)
+                kind[p] = SIMPLIFY_BORDER;
+            else if (copies[p].size() == 2 && openPositionEdges[p] == 0 &&
+                     openVertexEdges[copies[p][0]] == 2 && openVertexEdges[copies[p][1]] == 2)
+                kind[p] = SIMPLIFY_SEAM;
+        }
+    }
+
+    // moving the position of from onto to, ordered by the area weighted cost so small details go first. error is
+    // the root mean square distance of the merged position to its planes. the versions invalidate entries queued
+    // before either position changed.
+    struct Collapse {
+        double cost;
+        double error;
+        unsigned int from, to;
+        unsigned int fromVersion, toVersion;
+        bool operator>(const Collapse &other) const { return cost > other.cost; }
+    };
+    std::priority_queue<Collapse, vector<Collapse>, std::greater<Collapse>> heap;
+    vector<unsigned int> version(vertexCount, 0);
+    vector<char> removed(vertexCount, 0);
+    vector<unsigned int> neighbours, fromNeighbours;
+
+    // the vertices (or with positions set, the positions) sharing a live triangle with any copy of p
+    auto collectNeighbours = [&](unsigned int p, bool positions, vector<unsigned int> &out) {
+        out.clear();
+        for (unsigned int copy : copies[p])
+            for (unsigned int t : vertexTriangles[copy])
+                if (alive[t])
+                    for (int k = 0; k < 3; k++)
+                        if (position[triangles[t * 3 + k]] != p)
+                            out.push_back(positions ? position[triangles[t * 3 + k]] : triangles[t * 3 + k]);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+    auto containsPosition = [&](unsigned int t, unsigned int p) {
+        return position[triangles[t * 3]] == p || position[triangles[t * 3 + 1]] == p || position[triangles[t * 3 + 2]] == p;
+    };
+    auto queueCollapse = [&](unsigned int from, unsigned int to) {
+        const unsigned int pf = position[from], pt = position[to];
+        if (pf == pt || kind[pf] == SIMPLIFY_LOCKED)
+            return;
+        Quadric q = quadrics[pf];
+        q += quadrics[pt];
+        double cost = std::max(0.0, q.evaluate(glm::dvec3(vertices[to].Position)));
+        double error = q.weight > 0.0 ? std::sqrt(cost / q.weight) : 0.0;
+        heap.push({ cost, error, from, to, version[pf], version[pt] });
+    };
+    // checks that the kind of from allows moving along the edge to to and that the surface stays manifold, then
+    // finds the copy of to each copy of from merges into (the one it shares a triangle with)
+    auto findTargets = [&](unsigned int from, unsigned int to, unsigned int *targets) {
+        const unsigned int pf = position[from], pt = position[to];
+        unsigned int sharedTriangles = 0, sharedExactly = 0;
+        for (size_t i = 0; i < copies[pf].size(); i++)
+        {
+            targets[i] = ~0u;
+            for (unsigned int t : vertexTriangles[copies[pf][i]])
+            {
+                if (!alive[t] || !containsPosition(t, pt))
+                    continue;
+                sharedTriangles++;
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int w = triangles[t * 3 + k];
+                    if (position[w] != pt)
+                        continue;
+                    if (targets[i] != ~0u && targets[i] != w)
+                        return false;
+                    targets[i] = w;
+                    if (copies[pf][i] == from && w == to)
+                        sharedExactly++;
+                }
+            }
+            if (targets[i] == ~0u && !vertexTriangles[copies[pf][i]].empty())
+                return false;
+        }
+        if (kind[pf] == SIMPLIFY_BORDER && sharedTriangles != 1)
+            return false;
+        if (kind[pf] == SIMPLIFY_SEAM && (sharedTriangles != 2 || sharedExactly != 1))
+            return false;
+
+        // link condition: the edge's endpoints have no neighbours in common but the corners of the shared triangles
+        collectNeighbours(pf, true, fromNeighbours);
+        collectNeighbours(pt, true, neighbours);
+        unsigned int common = 0;
+        for (size_t i = 0, j = 0; i < fromNeighbours.size() && j < neighbours.size();)
+        {
+            if (fromNeighbours[i] < neighbours[j])
+                i++;
+            else if (neighbours[j] < fromNeighbours[i])
+                j++;
+            else
+                common++, i++, j++;
+        }
+        return common == sharedTriangles;
+    };
+    // a collapse must not turn the triangles around from over or squash them to nothing
+    auto keepsOrientation = [&](unsigned int from, unsigned int to) {
+        const unsigned int pf = position[from], pt = position[to];
+        const glm::dvec3 target = vertices[to].Position;
+        for (unsigned int copy : copies[pf])
+            for (unsigned int t : vertexTriangles[copy])
+            {
+                if (!alive[t] || containsPosition(t, pt))
+                    continue;
+                glm::dvec3 before[3], after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = vertices[triangles[t * 3 + k]].Position;
+                    after[k] = position[triangles[t * 3 + k]] == pf ? target : before[k];
+                }
+                glm::dvec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::dvec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                double lengths = glm::length(normalBefore) * glm::length(normalAfter);
+                if (lengths == 0.0 || glm::dot(normalBefore, normalAfter) < 0.2 * lengths)
+                    return false;
+            }
+        return true;
+    };
+    auto snapshot = [&](double error) {
+        SimplifiedLevel level;
+        for (size_t t = 0; t < triangleCount; t++)
+            if (alive[t])
+                level.indices.insert(level.indices.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+        level.error = static_cast<float>(error);
+        levels.push_back(std::move(level));
+    };
+
+    for (unsigned int p = 0; p < vertexCount; p++)
+    {
+        if (position[p] != p || kind[p] == SIMPLIFY_LOCKED)
+            continue;
+        for (unsigned int copy : copies[p])
+        {
+            collectNeighbours(p, false, neighbours);
+            for (unsigned int w : neighbours)
+                queueCollapse(copy, w);
+        }
+    }
+
+    double reachedError = 0.0;
+    size_t liveTriangles = triangleCount;
+    size_t target = 0;
+    unsigned int targets[2];
+    while (!heap.empty() && target < targetTriangleCounts.size())
+    {
+        Collapse collapse = heap.top();
+        heap.pop();
+        const unsigned int pf = position[collapse.from], pt = position[collapse.to];
+        if (removed[pf] || removed[pt] || collapse.fromVersion != version[pf] || collapse.toVersion != version[pt])
+            continue;
+        if (collapse.error > maxError || !findTargets(collapse.from, collapse.to, targets) || !keepsOrientation(collapse.from, collapse.to))
+            continue;
+
+        for (size_t i = 0; i < copies[pf].size(); i++)
+        {
+            const unsigned int copy = copies[pf][i];
+            for (unsigned int t : vertexTriangles[copy])
+            {
+                if (!alive[t])
+                    continue;
+                if (containsPosition(t, pt))
+                {
+                    alive[t] = 0;
+                    liveTriangles--;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                    if (triangles[t * 3 + k] == copy)
+                        triangles[t * 3 + k] = targets[i];
+                vertexTriangles[targets[i]].push_back(t);
+            }
+            vertexTriangles[copy].clear();
+        }
+        quadrics[pt] += quadrics[pf];
+        removed[pf] = 1;
+        version[pt]++;
+        reachedError = std::max(reachedError, collapse.error);
+
+        // the costs of every edge at the merged position changed, its old entries are stale by its version
+        collectNeighbours(pt, false, neighbours);
+        for (unsigned int copy : copies[pt])
+            for (unsigned int w : neighbours)
+            {
+                queueCollapse(copy, w);
+                queueCollapse(w, copy);
+            }
+
+        while (target < targetTriangleCounts.size() && liveTriangles <= targetTriangleCounts[target])
+        {
+            snapshot(reachedError);
+            target++;
+        }
+    }
+
+    // ran out of collapses before the next target, keep what was reached if it is worth a level of its own
+    size_t previousTriangles = levels.empty() ? triangleCount : levels.back().indices.size() / 3;
+    if (target < targetTriangleCounts.size() && liveTriangles < previousTriangles * 9 / 10)
+        snapshot(reachedError);
+    return levels;
+}
+#endif
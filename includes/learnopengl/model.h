@@ -11,13 +11,21 @@
 #include <assimp/postprocess.h>
 
 #include <learnopengl/mesh.h>
+#include <learnopengl/mesh_cache.h>
+#include <learnopengl/mesh_optimizer.h>
+#include <learnopengl/mesh_simplifier.h>
+#include <learnopengl/render_queue.h>
 #include <learnopengl/shader.h>
+#include <learnopengl/texture_cache.h>
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
@@ -31,28 +39,140 @@ public:
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    // object space bounds of all meshes, computed once at import
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    // object space error of each detail level every mesh has, 0 for level 0 and growing from there
+    vector<float> lodErrors = vector<float>(1, 0.0f);
 
-    Model() : gammaCorrection(false) {
+    Model() : gammaCorrection(false), deferUpload(false) {
         loadModel("");
     }
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // with deferUpload set only the CPU side of the import runs (Assimp parse, vertex conversion and texture
+    // decoding), which makes it safe to call from a worker thread; setupGL() must then run on the GL thread.
+    // textures come from the process wide TextureCache, so models referencing the same image share it.
+    Model(string const &path, bool gamma = false, bool deferUpload = false) : gammaCorrection(gamma), deferUpload(deferUpload)
     {
         loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader &shader)
+    // a model is an asset shared by all of its placed instances (see ModelData), copying one is always a mistake
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+    Model(Model&&) = default;
+    Model& operator=(Model&&) = default;
+
+    // creates the GL buffers and textures of a model that was loaded with deferUpload
+    void setupGL()
     {
+        if (!deferUpload)
+            return;
+        for (unsigned int i = 0; i < textures_loaded.size(); i++)
+            textures_loaded[i].id = sharedTextures[i]->upload();
+
+        for (Mesh &mesh : meshes)
+        {
+            // the meshes hold copies of the texture structs, so patch in the ids that were just created
+            for (Texture &texture : mesh.textures)
+            {
+                for (const Texture &loaded : textures_loaded)
+                {
+                    if (loaded.path == texture.path)
+                    {
+                        texture.id = loaded.id;
+                        break;
+                    }
+                }
+            }
+            mesh.setupMesh();
+        }
+        setupInstancing();
+        cacheMapping.reset();
+        deferUpload = false;
+    }
+
+    // uploads the matrices of every placed instance of this model, Draw() renders all of them
+    void setInstances(const InstanceData *instances, size_t count) const
+    {
+        instanceCount = static_cast<unsigned int>(count);
+        if (!instanceVBO || count == 0)
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        if (count > instanceCapacity)
+            instanceCapacity = std::max(count, instanceCapacity * 2);
+        // orphan the old storage, draws of the previous frame may still read it
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceData), instances);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // draws the model, and thus all its meshes, once for each instance passed to setInstances()
+    void Draw() const
+    {
+        if (instanceCount == 0)
+            return;
         for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+            meshes[i].Draw(instanceCount);
+    }
+
+    // like Draw(), but adds the draws to queue to be sorted together with those of the other models. draws
+    // instanceCount of the instances passed to setInstances() from firstInstance on, at detail level lod.
+    void Enqueue(RenderQueue &queue, const Shader &shader, size_t lod = 0, unsigned int firstInstance = 0, unsigned int instanceCount = ~0u) const
+    {
+        instanceCount = std::min(instanceCount, this->instanceCount - std::min(firstInstance, this->instanceCount));
+        for (const Mesh &mesh : meshes)
+            queue.add(shader, mesh, lod, firstInstance, instanceCount);
+    }
+
+    // the coarsest detail level whose error stays below maxError, with the error in object space units
+    size_t SelectLod(float maxError) const
+    {
+        size_t lod = 0;
+        while (lod + 1 < lodErrors.size() && lodErrors[lod + 1] <= maxError)
+            lod++;
+        return lod;
     }
     
 private:
+    bool deferUpload;
+    vector<shared_ptr<SharedTexture>> sharedTextures; // cache references backing textures_loaded, same order
+    shared_ptr<MappedFile> cacheMapping; // cache entry the meshes were loaded from, kept until their upload
+    // per instance model matrices shared by the VAOs of all meshes. drawing state rather than asset data,
+    // hence mutable: a const model can still be drawn with different instances every frame
+    mutable unsigned int instanceVBO = 0;
+    mutable size_t instanceCapacity = 0;
+    mutable unsigned int instanceCount = 0;
+
+    // creates the instance buffer and points every mesh at it. GL thread only.
+    void setupInstancing()
+    {
+        glGenBuffers(1, &instanceVBO);
+        for (Mesh &mesh : meshes)
+            mesh.setInstanceBuffer(instanceVBO);
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // warm start: take the baked meshes from the cache and skip the import entirely
+        if (!path.empty() && MeshCache::load(path, meshes, boundsMin, boundsMax, lodErrors, cacheMapping, !deferUpload))
+        {
+            for (Mesh &mesh : meshes)
+                for (Texture &texture : mesh.textures)
+                    texture = acquireTexture(texture.path.c_str(), texture.type);
+            if (!deferUpload)
+            {
+                setupInstancing();
+                cacheMapping.reset();
+            }
+            return;
+        }
+
         // read file via ASSIMP
         Assimp::Importer importer;
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
@@ -62,11 +182,37 @@ private:
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        // one mesh per material, so a model costs one draw call per texture set instead of one per OBJ group
+        const size_t importedMeshes = meshes.size();
+        mergeMeshesByMaterial();
+
+        // assimp hands out three vertices per triangle in file order, weld and reorder them for the GPU caches
+        MeshOptimizerStats stats;
+        for (Mesh &mesh : meshes)
+        {
+            stats += OptimizeMesh(mesh.vertices, mesh.indices, mesh.format);
+            mesh.vertexCount = static_cast<unsigned int>(mesh.vertices.size());
+            mesh.indexCount = static_cast<unsigned int>(mesh.indices.size());
+        }
+        cout << "Optimized " << path << ": " << importedMeshes << " meshes -> " << meshes.size() << " draw calls, ACMR " << stats.before.acmr() << " -> " << stats.after.acmr()
+             << ", ATVR " << stats.before.atvr() << " -> " << stats.after.atvr() << endl;
+
+        computeBounds();
+        generateLods();
+
+        // bake the result so the next start can skip the import
+        MeshCache::store(path, meshes, boundsMin, boundsMax, lodErrors);
+
+        if (!deferUpload)
+        {
+            for (Mesh &mesh : meshes)
+                mesh.setupMesh();
+            setupInstancing();
+        }
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -98,7 +244,7 @@ private:
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            Vertex vertex = {};
             glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -156,78 +302,175 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, TEXTURE_DIFFUSE);
         textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, TEXTURE_SPECULAR);
         textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, TEXTURE_NORMAL);
         textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
+        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, TEXTURE_HEIGHT);
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         
+        // only skinned meshes need the full vertex, normal mapped ones keep a packed tangent
+        VertexFormat format = VERTEX_FORMAT_STATIC;
+        if (mesh->HasBones())
+            format = VERTEX_FORMAT_SKINNED;
+        else if (mesh->HasTangentsAndBitangents() && (!normalMaps.empty() || !heightMaps.empty()))
+            format = VERTEX_FORMAT_STATIC_TANGENT;
+
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // uploaded by loadModel once the meshes are optimized
+        return Mesh(vertices, indices, textures, false, format);
+    }
+
+    void computeBounds()
+    {
+        boundsMin = glm::vec3(std::numeric_limits<float>::max());
+        boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+        for (const Mesh &mesh : meshes)
+        {
+            for (const Vertex &vertex : mesh.vertices)
+            {
+                boundsMin = glm::min(boundsMin, vertex.Position);
+                boundsMax = glm::max(boundsMax, vertex.Position);
+            }
+        }
+    }
+
+    // appends the coarser detail levels of every mesh to its index buffer, level n keeps about 1/2^n of the triangles.
+    // every mesh gets the same number of levels, one that can't be reduced as far repeats its last level. the
+    // simplifier may move the surface by at most 5% of the model's size, so small meshes stop early.
+    void generateLods()
+    {
+        const float maxError = glm::length(boundsMax - boundsMin) * 0.05f;
+        vector<vector<SimplifiedLevel>> simplified(meshes.size());
+        size_t levels = 1;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const size_t triangles = meshes[i].indices.size() / 3;
+            vector<size_t> targets;
+            for (size_t lod = 1; lod < MESH_MAX_LODS; lod++)
+                targets.push_back(triangles >> lod);
+            simplified[i] = SimplifyMesh(meshes[i].vertices, meshes[i].indices, targets, maxError);
+            levels = std::max(levels, simplified[i].size() + 1);
+        }
+
+        lodErrors.assign(levels, 0.0f);
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            Mesh &mesh = meshes[i];
+            mesh.lods.assign(1, MeshLod{ 0, static_cast<unsigned int>(mesh.indices.size()) });
+            for (size_t lod = 1; lod < levels; lod++)
+            {
+                if (lod > simplified[i].size())
+                {
+                    mesh.lods.push_back(mesh.lods.back());
+                    continue;
+                }
+                SimplifiedLevel &level = simplified[i][lod - 1];
+                OptimizeVertexCache(level.indices, mesh.vertices.size());
+                mesh.lods.push_back({ static_cast<unsigned int>(mesh.indices.size()), static_cast<unsigned int>(level.indices.size()) });
+                mesh.indices.insert(mesh.indices.end(), level.indices.begin(), level.indices.end());
+                lodErrors[lod] = std::max(lodErrors[lod], level.error);
+            }
+            mesh.indexCount = static_cast<unsigned int>(mesh.indices.size());
+        }
+        for (size_t lod = 1; lod < levels; lod++)
+            lodErrors[lod] = std::max(lodErrors[lod], lodErrors[lod - 1]);
+    }
+
+    // merges the meshes sharing their texture set and vertex format into one vertex/index buffer, the indices
+    // of each merged mesh are offset by the vertices that precede it. keeps the order of first appearance.
+    void mergeMeshesByMaterial()
+    {
+        vector<Mesh> merged;
+        map<string, size_t> materials; // texture set and format -> index into merged
+        for (Mesh &mesh : meshes)
+        {
+            string key = to_string(mesh.format);
+            for (const Texture &texture : mesh.textures)
+                key += '\n' + to_string(texture.type) + '\n' + texture.path;
+
+            auto it = materials.find(key);
+            if (it == materials.end())
+            {
+                materials[key] = merged.size();
+                merged.push_back(std::move(mesh));
+                continue;
+            }
+            Mesh &target = merged[it->second];
+            const unsigned int baseVertex = static_cast<unsigned int>(target.vertices.size());
+            target.vertices.insert(target.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            for (unsigned int index : mesh.indices)
+                target.indices.push_back(baseVertex + index);
+        }
+        for (Mesh &mesh : merged)
+        {
+            mesh.vertexCount = static_cast<unsigned int>(mesh.vertices.size());
+            mesh.indexCount = static_cast<unsigned int>(mesh.indices.size());
+        }
+        meshes = std::move(merged);
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
     // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, TextureType textureType)
     {
         vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
-            }
+            textures.push_back(acquireTexture(str.C_Str(), textureType));
         }
         return textures;
     }
-};
-
-struct AABB { 
-    glm::vec3 minCorner;
-    glm::vec3 maxCorner;
 
-    AABB() : minCorner(glm::vec3(std::numeric_limits<float>::max())), maxCorner(glm::vec3(std::numeric_limits<float>::lowest())) {}
-    AABB(const glm::vec3 &min, const glm::vec3 &max) : minCorner(min), maxCorner(max) {}
+    // returns the texture at the given path relative to the model, loading it if nobody has loaded it yet
+    Texture acquireTexture(const char *path, TextureType type)
+    {
+        shared_ptr<SharedTexture> shared = TextureCache::instance().acquire(path, this->directory, gammaCorrection);
+        // check if this model references the texture already, so textures_loaded holds every texture once
+        for(unsigned int j = 0; j < sharedTextures.size(); j++)
+        {
+            if(sharedTextures[j] == shared)
+            {
+                Texture texture = textures_loaded[j];
+                texture.type = type; // the same image may serve as another kind of map elsewhere
+                return texture;
+            }
+        }
+        Texture texture;
+        if (deferUpload)
+        {
+            shared->decode();
+            texture.id = 0;
+        }
+        else
+            texture.id = shared->upload();
+        texture.type = type;
+        texture.path = path;
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+        sharedTextures.push_back(shared);
+        return texture;
+    }
 };
 
+// one placed piece of furniture: a handle to the shared, immutable model asset plus its own transform
 struct ModelData {
-    Model model;
+    shared_ptr<const Model> model;
     glm::vec3 translate;
     float rotate;
     glm::vec3 scale;
 
-    /*AABB boundingBox;*/
-    /*glm::vec3 minCorner;
-    glm::vec3 maxCorner;*/
-
     bool valid = false; // used in order to check if the model is valid or just a placeholder, since initializing structs to null is not possible
+    unsigned int id = 0; // tells the placed models apart while they move between models and currentModel
 
     bool operator==(const ModelData& other) {
-        return this->model.directory == other.model.directory &&
+        return this->model == other.model &&
             this->translate == other.translate &&
             this->rotate == other.rotate &&
             this->scale == other.scale &&
@@ -237,41 +480,12 @@ struct ModelData {
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
-    string filename = string(path);
-    filename = directory + '/' + filename;
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
+    CompressedTexture compressed;
+    if (LoadCompressedTexture(path, directory, compressed))
+        return UploadCompressedTexture(compressed);
 
-    return textureID;
+    TextureImage image;
+    LoadTextureImage(path, directory, image);
+    return UploadTextureImage(image, gamma);
 }
 #endif
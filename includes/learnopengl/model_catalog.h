@@ -0,0 +1,127 @@
+#ifndef MODEL_CATALOG_H
+#define MODEL_CATALOG_H
+
+#include <learnopengl/model.h>
+#include <learnopengl/thread_pool.h>
+
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// one selectable model file, only its metadata is known until something asks for the model itself
+struct CatalogEntry {
+    string path;        // absolute path of the model file
+    string name;        // label shown in the UI, path relative to the catalog folder
+    uintmax_t fileSize;
+
+    std::shared_ptr<Model> model;  // set once the import finished and the model is on the GPU
+    std::future<Model> pending;    // background import started by prefetch()
+};
+
+// lists the model files of a folder and imports each of them only the first time it is needed
+class ModelCatalog
+{
+public:
+    ModelCatalog(ThreadPool &pool) : pool(pool) {}
+
+    // cheap metadata scan, nothing is imported here; prefetch()/acquire() import an entry the first time it is needed
+    void scan(const vector<string> &files, const string &rootFolder)
+    {
+        entries.clear();
+        for (const string &file : files)
+        {
+            std::error_code error;
+            std::filesystem::path fullPath = std::filesystem::absolute(file);
+            std::filesystem::path relative = std::filesystem::relative(fullPath, std::filesystem::absolute(rootFolder), error);
+
+            CatalogEntry entry;
+            entry.path = fullPath.generic_string();
+            entry.name = error || relative.empty() ? fullPath.filename().generic_string() : relative.generic_string();
+            entry.fileSize = std::filesystem::file_size(fullPath, error);
+            if (error)
+                entry.fileSize = 0;
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+    const CatalogEntry &entry(size_t index) const
+    {
+        return entries[index];
+    }
+
+    bool isLoaded(size_t index) const
+    {
+        return entries[index].model != nullptr;
+    }
+
+    // true while a background import is still running
+    bool isLoading() const
+    {
+        for (const CatalogEntry &entry : entries)
+            if (entry.pending.valid())
+                return true;
+        return false;
+    }
+
+    // starts importing the entry on the worker pool if that hasn't happened yet
+    void prefetch(size_t index)
+    {
+        CatalogEntry &entry = entries[index];
+        if (entry.model || entry.pending.valid())
+            return;
+        string path = entry.path;
+        entry.pending = pool.enqueue([path] { return Model(path, false, true); });
+    }
+
+    // returns the model of the entry, importing it now or waiting for its prefetch. GL thread only.
+    // every placed instance holds on to the same asset, the catalog keeps it alive in between.
+    std::shared_ptr<const Model> acquire(size_t index)
+    {
+        CatalogEntry &entry = entries[index];
+        if (!entry.model)
+        {
+            if (entry.pending.valid())
+                finishImport(entry);
+            else
+                entry.model = std::make_shared<Model>(entry.path);
+        }
+        return entry.model;
+    }
+
+    // drops every entry together with its imported model and texture references. GL thread only.
+    void clear()
+    {
+        entries.clear();
+    }
+
+    // uploads the models whose background import finished, call once per frame on the GL thread
+    void update()
+    {
+        for (CatalogEntry &entry : entries)
+        {
+            if (entry.pending.valid() && entry.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                finishImport(entry);
+        }
+    }
+
+private:
+    ThreadPool &pool;
+    vector<CatalogEntry> entries;
+
+    void finishImport(CatalogEntry &entry)
+    {
+        Model model = entry.pending.get();
+        model.setupGL();
+        entry.model = std::make_shared<Model>(std::move(model));
+    }
+};
+#endif
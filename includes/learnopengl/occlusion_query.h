@@ -0,0 +1,152 @@
+#ifndef OCCLUSION_QUERY_H
+#define OCCLUSION_QUERY_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// one GL_ANY_SAMPLES_PASSED query per object, e.g. per placed instance of a model. results are only read once
+// the GPU reports them available, never waiting for it, so the visibility of an object is that of its last
+// finished query: one frame old normally, older while the GPU lags behind. GL thread only.
+class OcclusionQueries
+{
+public:
+    OcclusionQueries() = default;
+    OcclusionQueries(const OcclusionQueries&) = delete;
+    OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+    OcclusionQueries(OcclusionQueries &&other) noexcept
+    {
+        swap(other);
+    }
+    OcclusionQueries& operator=(OcclusionQueries &&other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+    ~OcclusionQueries()
+    {
+        release();
+    }
+
+    // forgets every result and sets the number of objects, all of them count as visible again. results are kept
+    // by object index, so this has to be called whenever the objects change places as well.
+    void reset(size_t count)
+    {
+        release();
+        queries.resize(count);
+        if (count > 0)
+            glGenQueries(static_cast<GLsizei>(count), queries.data());
+        occluded.assign(count, 0);
+        pending.assign(count, 0);
+        pendingCount = 0;
+    }
+
+    // picks up the results that arrived since the last call, returns whether any object changed its visibility
+    bool collect()
+    {
+        bool changed = false;
+        for (size_t i = 0; pendingCount > 0 && i < queries.size(); i++)
+        {
+            if (!pending[i])
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint anySamples = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &anySamples);
+            const unsigned char hidden = anySamples == 0;
+            changed |= occluded[i] != hidden;
+            occluded[i] = hidden;
+            pending[i] = 0;
+            pendingCount--;
+        }
+        return changed;
+    }
+
+    // whether results are still on their way, the objects may change visibility without anything else changing
+    bool hasPending() const
+    {
+        return pendingCount > 0;
+    }
+
+    bool isOccluded(size_t object) const
+    {
+        return occluded[object] != 0;
+    }
+
+    // drops the result of object, e.g. when the camera is inside its bounds and it can't be tested
+    void markVisible(size_t object)
+    {
+        occluded[object] = 0;
+    }
+
+    // the samples drawn until end() decide whether object is visible. returns false, starting nothing, while
+    // the previous query of object is still in flight.
+    bool begin(size_t object)
+    {
+        if (pending[object])
+            return false;
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[object]);
+        return true;
+    }
+
+    void end(size_t object)
+    {
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        pending[object] = 1;
+        pendingCount++;
+    }
+
+private:
+    std::vector<GLuint> queries;
+    std::vector<unsigned char> occluded;
+    std::vector<unsigned char> pending;
+    size_t pendingCount = 0;
+
+    void swap(OcclusionQueries &other)
+    {
+        queries.swap(other.queries);
+        occluded.swap(other.occluded);
+        pending.swap(other.pending);
+        std::swap(pendingCount, other.pendingCount);
+    }
+
+    void release()
+    {
+        if (!queries.empty())
+            glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+        queries.clear();
+    }
+};
+
+// VAO of the cube spanning [-1, 1]^3 as 12 triangles of unsigned byte indices, the proxy drawn for a query.
+// occlusion_box.vert scales it to the bounds being tested.
+inline unsigned int CreateOcclusionBoxVAO()
+{
+    static const float corners[] = {
+        -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,  -1.0f,  1.0f, -1.0f,   1.0f,  1.0f, -1.0f,
+        -1.0f, -1.0f,  1.0f,   1.0f, -1.0f,  1.0f,  -1.0f,  1.0f,  1.0f,   1.0f,  1.0f,  1.0f
+    };
+    static const unsigned char faces[] = {
+        0, 2, 1,  1, 2, 3,   4, 5, 6,  5, 7, 6,   // -z, +z
+        0, 1, 4,  1, 5, 4,   2, 6, 3,  3, 6, 7,   // -y, +y
+        0, 4, 2,  2, 4, 6,   1, 3, 5,  3, 7, 5    // -x, +x
+    };
+    unsigned int vao, vbo, ebo;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glBindVertexArray(0);
+    return vao;
+}
+#endif
@@ -0,0 +1,141 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/file_cache.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// bump whenever the entry layout changes, old entries are then recompiled
+#define PROGRAM_CACHE_VERSION 1
+#define PROGRAM_CACHE_MAGIC 0x50475052 // "RPGP"
+
+// An entry is the header followed by the driver's binary of one linked program.
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;  // binaryFormat from glGetProgramBinary
+    uint32_t length;
+};
+
+// linked programs kept across runs with glGetProgramBinary / glProgramBinary, so later starts skip compiling and
+// linking. entries are keyed by the fully expanded sources of the stages and the vendor, renderer and version
+// strings of the driver; a binary the driver no longer accepts (e.g. after an update that kept the version string)
+// fails to load and the program is built from source again. GL thread only.
+class ProgramCache
+{
+public:
+    // folder holding the cache entries, relative to the working directory unless made absolute
+    static std::string &directory()
+    {
+        static std::string cacheDirectory = "cache/programs";
+        return cacheDirectory;
+    }
+
+    // whether the context can hand out and take back program binaries at all
+    static bool supported()
+    {
+        if (!glGetProgramBinary || !glProgramBinary || !glProgramParameteri)
+            return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    // identifies a program built from the given sources (defines and includes already expanded) on this driver
+    static uint64_t key(const std::vector<std::string> &sources)
+    {
+        uint64_t hash = HashBytes(nullptr, 0);
+        const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (GLenum name : driverStrings)
+        {
+            const char *text = reinterpret_cast<const char*>(glGetString(name));
+            if (text)
+                hash = HashBytes(text, std::strlen(text) + 1, hash);
+        }
+        for (const std::string &source : sources)
+        {
+            uint64_t length = source.size();
+            hash = HashBytes(&length, sizeof(length), hash);
+            hash = HashBytes(source.data(), source.size(), hash);
+        }
+        return hash;
+    }
+
+    // creates a linked program from the entry of key, 0 when there is none or the driver rejects it
+    static GLuint load(uint64_t key)
+    {
+        if (!supported())
+            return 0;
+        MappedFile file(entryPath(key));
+        if (!file.isOpen() || file.size() < sizeof(ProgramCacheHeader))
+            return 0;
+        ProgramCacheHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (header.magic != PROGRAM_CACHE_MAGIC || header.version != PROGRAM_CACHE_VERSION || header.key != key ||
+            header.length != file.size() - sizeof(header))
+            return 0;
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, header.format, file.data() + sizeof(header), static_cast<GLsizei>(header.length));
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+
+    // call before linking a program that is going to be stored, some drivers only keep the binary when asked to
+    static void prepare(GLuint program)
+    {
+        if (supported())
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // writes the binary of a successfully linked program as the entry of key
+    static bool store(uint64_t key, GLuint program)
+    {
+        if (!supported())
+            return false;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return false;
+
+        std::vector<unsigned char> buffer(sizeof(ProgramCacheHeader) + length);
+        GLenum format = 0;
+        GLsizei written = 0;
+        glGetProgramBinary(program, length, &written, &format, buffer.data() + sizeof(ProgramCacheHeader));
+        if (written <= 0)
+            return false;
+        ProgramCacheHeader header = {};
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.key = key;
+        header.format = format;
+        header.length = static_cast<uint32_t>(written);
+        std::memcpy(buffer.data(), &header, sizeof(header));
+
+        if (!WriteFileAtomically(entryPath(key), buffer.data(), sizeof(header) + written))
+        {
+            std::cout << "ERROR::PROGRAM_CACHE:: could not write cache entry " << entryPath(key) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static std::string entryPath(uint64_t key)
+    {
+        return directory() + "/" + HashToString(key) + ".program";
+    }
+};
+#endif
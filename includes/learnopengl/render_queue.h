@@ -0,0 +1,152 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/texture_units.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// bind calls a pass issued, and how many the same draws would have issued in the order they were added
+struct RenderQueueStats {
+    int draws = 0;
+    int programChanges = 0;
+    int vaoChanges = 0;
+    int textureChanges = 0;
+    int unsortedProgramChanges = 0;
+    int unsortedVaoChanges = 0;
+    int unsortedTextureChanges = 0;
+};
+
+// one instanced draw of a detail level of a mesh. the instance transforms are already in the VAO's instance
+// buffer, the draw reads instanceCount of them from firstInstance on.
+struct DrawPacket {
+    uint64_t key;
+    unsigned int program;
+    const Mesh *mesh;
+    MeshLod lod;
+    unsigned int firstInstance;
+    unsigned int instanceCount;
+};
+
+// collects the draws of a pass, orders them by program, then material, then VAO and submits them
+// skipping every bind that would not change the GL state. the packets must be submitted in the frame
+// they were added, the queue does not keep the meshes alive. they can be submitted more than once, e.g.
+// by a depth pre-pass drawing them with its own program before the lit pass.
+class RenderQueue
+{
+public:
+    void clear()
+    {
+        packets.clear();
+    }
+
+    // makes room for count packets, so adding and submitting up to that many does not allocate
+    void reserve(size_t count)
+    {
+        packets.reserve(count);
+        sorted.reserve(count);
+    }
+
+    void add(const Shader &shader, const Mesh &mesh, size_t lod, unsigned int firstInstance, unsigned int instanceCount)
+    {
+        const MeshLod &range = mesh.lod(lod);
+        if (instanceCount == 0 || range.indexCount == 0)
+            return;
+        packets.push_back({ sortKey(shader.ID, mesh), shader.ID, &mesh, range, firstInstance, instanceCount });
+    }
+
+    // sorts and draws the packets. bindTextures is false for passes whose program samples no material
+    // texture (the depth passes), they are then ordered by VAO alone. with program set every packet is
+    // drawn with it instead of the program it was added with.
+    void submit(RenderQueueStats &stats, bool bindTextures = true, const Shader *program = nullptr)
+    {
+        stats = RenderQueueStats();
+        const unsigned int programOverride = program ? program->ID : 0;
+        replay(packets, false, bindTextures, programOverride, stats.unsortedProgramChanges, stats.unsortedVaoChanges, stats.unsortedTextureChanges);
+        // sorted is a copy, the packets keep their order and keys for the next submit
+        const uint64_t keyMask = bindTextures ? ~0ull : ~MATERIAL_KEY_MASK;
+        sorted.assign(packets.begin(), packets.end());
+        std::sort(sorted.begin(), sorted.end(), [keyMask](const DrawPacket &a, const DrawPacket &b) { return (a.key & keyMask) < (b.key & keyMask); });
+
+        replay(sorted, true, bindTextures, programOverride, stats.programChanges, stats.vaoChanges, stats.textureChanges);
+        stats.draws = static_cast<int>(sorted.size());
+    }
+
+    size_t size() const
+    {
+        return packets.size();
+    }
+
+private:
+    static const int MAX_TRACKED_UNITS = MATERIAL_TEXTURE_UNIT_BASE + TEXTURE_TYPE_COUNT * MAX_TEXTURES_PER_TYPE;
+    static const uint64_t MATERIAL_KEY_MASK = 0xFFFFFull << 24;
+
+    std::vector<DrawPacket> packets;  // in the order they were added
+    std::vector<DrawPacket> sorted;   // the last submit's order
+
+    // program (20 bits) | first texture, which is the diffuse map if there is one (20 bits) | VAO (24 bits).
+    // GL names are small integers so truncating them rarely merges two groups, and that only costs a bind.
+    static uint64_t sortKey(unsigned int program, const Mesh &mesh)
+    {
+        uint64_t material = mesh.textures.empty() ? 0 : mesh.textures[0].id;
+        return (uint64_t(program & 0xFFFFF) << 44) | ((material & 0xFFFFF) << 24) | (mesh.VAO & 0xFFFFFF);
+    }
+
+    // walks draws in their order and counts the binds that change state, issuing them and the draws when
+    // issue is set. a nonzero programOverride replaces the program of every packet.
+    static void replay(const std::vector<DrawPacket> &draws, bool issue, bool bindTextures, unsigned int programOverride,
+        int &programChanges, int &vaoChanges, int &textureChanges)
+    {
+        unsigned int program = ~0u, vao = ~0u;
+        unsigned int boundTextures[MAX_TRACKED_UNITS];
+        std::fill(boundTextures, boundTextures + MAX_TRACKED_UNITS, ~0u);
+        programChanges = vaoChanges = textureChanges = 0;
+        for (const DrawPacket &packet : draws)
+        {
+            const Mesh &mesh = *packet.mesh;
+            const unsigned int packetProgram = programOverride ? programOverride : packet.program;
+            if (packetProgram != program)
+            {
+                program = packetProgram;
+                programChanges++;
+                if (issue)
+                    glUseProgram(program);
+            }
+            for (size_t i = 0; bindTextures && i < mesh.textures.size(); i++)
+            {
+                int unit = mesh.textureUnits[i];
+                if (unit < 0 || unit >= MAX_TRACKED_UNITS || boundTextures[unit] == mesh.textures[i].id)
+                    continue;
+                boundTextures[unit] = mesh.textures[i].id;
+                textureChanges++;
+                if (issue)
+                {
+                    glActiveTexture(GL_TEXTURE0 + unit);
+                    glBindTexture(GL_TEXTURE_2D, mesh.textures[i].id);
+                }
+            }
+            if (mesh.VAO != vao)
+            {
+                vao = mesh.VAO;
+                vaoChanges++;
+                if (issue)
+                    glBindVertexArray(vao);
+            }
+            if (issue)
+            {
+                mesh.useInstanceRange(packet.firstInstance);
+                glDrawElementsInstanced(GL_TRIANGLES, packet.lod.indexCount, GL_UNSIGNED_INT, (void*)(packet.lod.indexOffset * sizeof(unsigned int)), packet.instanceCount);
+            }
+        }
+        if (issue)
+        {
+            glBindVertexArray(0);
+            glActiveTexture(GL_TEXTURE0);
+        }
+    }
+};
+#endif
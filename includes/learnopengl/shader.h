@@ -4,6 +4,8 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <learnopengl/texture_units.h>
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -94,7 +96,7 @@ public:
         glDeleteShader(fragment);
         if(geometryPath != nullptr)
             glDeleteShader(geometry);
-
+        BindMaterialSamplers(ID);
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -4,71 +4,52 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <learnopengl/program_cache.h>
+#include <learnopengl/texture_units.h>
+
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
+#include <vector>
+
+// FNV-1a of a uniform name, constexpr so hot names can be hashed at compile time
+constexpr uint64_t UniformHash(std::string_view name)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : name)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly. defines (e.g. "#define SHADOW_KERNEL_SIZE 2\n") are inserted
+    // after the #version line of both stages, #include "file" lines are resolved relative to the including file.
+    // the linked program is kept in the ProgramCache, later runs load it from there while the expanded sources and
+    // the driver stay the same.
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines = "")
     {
         // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-        }
-        catch (std::ifstream::failure& e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
-        }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
+        std::string vertexCode = loadSource(vertexPath, defines);
+        std::string fragmentCode = loadSource(fragmentPath, defines);
+        // 2. take the program from the cache or build it
+        const uint64_t cacheKey = ProgramCache::key({ vertexCode, fragmentCode });
+        ID = ProgramCache::load(cacheKey);
+        if (!ID)
+            build(vertexCode, fragmentCode, cacheKey);
+        cacheUniformLocations();
+        BindMaterialSamplers(ID);
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -76,66 +57,235 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // location of a uniform from the table built at link time, -1 (ignored by glUniform*) if it isn't active
+    // ------------------------------------------------------------------------
+    GLint location(std::string_view name) const
+    {
+        return location(UniformHash(name));
+    }
+    GLint location(uint64_t nameHash) const
+    {
+        auto it = std::lower_bound(uniformLocations.begin(), uniformLocations.end(), std::make_pair(nameHash, GLint(-1)),
+            [](const std::pair<uint64_t, GLint> &a, const std::pair<uint64_t, GLint> &b) { return a.first < b.first; });
+        return it != uniformLocations.end() && it->first == nameHash ? it->second : -1;
+    }
+    // connects a uniform block of the program to a uniform buffer binding point
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const char *blockName, GLuint binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, blockName);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(std::string_view name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(location(name), (int)value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(std::string_view name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(std::string_view name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(std::string_view name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(location(name), 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(std::string_view name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(location(name), x, y); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(std::string_view name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(location(name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(std::string_view name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(location(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(std::string_view name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(location(name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) const
+    void setVec4(std::string_view name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(location(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(std::string_view name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(std::string_view name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(std::string_view name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    // compiles and links the expanded sources into ID, storing the program under cacheKey when it links
+    // ------------------------------------------------------------------------
+    void build(const std::string &vertexCode, const std::string &fragmentCode, uint64_t cacheKey)
+    {
+        const char* vShaderCode = vertexCode.c_str();
+        const char * fShaderCode = fragmentCode.c_str();
+        // compile shaders
+        unsigned int vertex, fragment;
+        // vertex shader
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+        // fragment Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, "FRAGMENT");
+        // shader Program
+        ID = glCreateProgram();
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        ProgramCache::prepare(ID);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessary
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        // keep the result for the next run
+        GLint linked = GL_FALSE;
+        glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+        if (linked)
+            ProgramCache::store(cacheKey, ID);
+    }
+    // reads a shader stage and expands its includes, the sources are numbered for the compile errors:
+    // 0 is the stage itself, included files count up from 1 in the order they are first included
+    // ------------------------------------------------------------------------
+    static std::string loadSource(const std::string &path, const std::string &defines)
+    {
+        std::string code;
+        if (!readFile(path, code))
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return code;
+        }
+        std::vector<std::string> included;
+        std::string expanded = expandIncludes(code, directoryOf(path), 0, included);
+        // the defines have to follow #version, which must stay the first statement
+        if (!defines.empty())
+        {
+            size_t version = expanded.find("#version");
+            size_t insert = version == std::string::npos ? 0 : expanded.find('\n', version);
+            insert = insert == std::string::npos ? expanded.size() : insert + 1;
+            expanded.insert(insert, defines + "#line 2 0\n");
+        }
+        return expanded;
+    }
+    // ------------------------------------------------------------------------
+    static std::string expandIncludes(const std::string &code, const std::string &directory, int sourceNumber, std::vector<std::string> &included)
+    {
+        std::stringstream input(code);
+        std::string output, line;
+        int lineNumber = 0;
+        while (std::getline(input, line))
+        {
+            lineNumber++;
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+            {
+                output += line + '\n';
+                continue;
+            }
+            size_t open = line.find('"', start);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if (close == std::string::npos)
+            {
+                std::cout << "ERROR::SHADER::INVALID_INCLUDE: " << line << std::endl;
+                output += '\n'; // keeps the line numbers of the file
+                continue;
+            }
+            std::string path = directory + line.substr(open + 1, close - open - 1);
+            // every file is included once, like with an include guard
+            if (std::find(included.begin(), included.end(), path) != included.end())
+            {
+                output += '\n';
+                continue;
+            }
+            included.push_back(path);
+            int includedNumber = static_cast<int>(included.size());
+            std::string includedCode;
+            if (!readFile(path, includedCode))
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+                output += '\n';
+                continue;
+            }
+            output += "#line 1 " + std::to_string(includedNumber) + '\n';
+            output += expandIncludes(includedCode, directoryOf(path), includedNumber, included);
+            output += "#line " + std::to_string(lineNumber + 1) + ' ' + std::to_string(sourceNumber) + '\n';
+        }
+        return output;
+    }
+    // ------------------------------------------------------------------------
+    static bool readFile(const std::string &path, std::string &code)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        code = stream.str();
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    static std::string directoryOf(const std::string &path)
+    {
+        size_t slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    }
+
+    // (name hash, location) of every active uniform, sorted by hash
+    std::vector<std::pair<uint64_t, GLint>> uniformLocations;
+
+    // resolves the locations of all active uniforms once, so the setters never query GL by string
+    // ------------------------------------------------------------------------
+    void cacheUniformLocations()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+            GLint uniformLocation = glGetUniformLocation(ID, name.data());
+            if (uniformLocation < 0)
+                continue; // member of a uniform block
+            std::string_view uniformName(name.data(), length);
+            uniformLocations.emplace_back(UniformHash(uniformName), uniformLocation);
+            // arrays are reported as "name[0]", make them reachable by their plain name as well
+            if (uniformName.size() > 3 && uniformName.substr(uniformName.size() - 3) == "[0]")
+                uniformLocations.emplace_back(UniformHash(uniformName.substr(0, uniformName.size() - 3)), uniformLocation);
+        }
+        std::sort(uniformLocations.begin(), uniformLocations.end());
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,154 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/file_cache.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// the part of the shadow map that has to be drawn again, in texels
+struct ShadowRegion {
+    bool redraw = false;
+    bool full = false;
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// orthographic light projection that encloses the box seen through lightView as tightly as possible. the box is
+// first snapped outward to a grid of snap units, so small changes of the scene keep the projection (and with it
+// the cached shadow map) as is. returns the near and far planes for the depth visualization.
+inline glm::mat4 FitLightProjection(const glm::mat4 &lightView, glm::vec3 boundsMin, glm::vec3 boundsMax, float snap, float &nearPlane, float &farPlane)
+{
+    boundsMin = glm::floor(boundsMin / snap) * snap;
+    boundsMax = glm::ceil(boundsMax / snap) * snap;
+    glm::vec3 lightMin(1e30f), lightMax(-1e30f);
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec3 corner(i & 1 ? boundsMax.x : boundsMin.x, i & 2 ? boundsMax.y : boundsMin.y, i & 4 ? boundsMax.z : boundsMin.z);
+        glm::vec3 view = glm::vec3(lightView * glm::vec4(corner, 1.0f));
+        lightMin = glm::min(lightMin, view);
+        lightMax = glm::max(lightMax, view);
+    }
+    // the light looks down -z, keep a little depth in front of and behind the box
+    nearPlane = -lightMax.z - 0.1f;
+    farPlane = -lightMin.z + 0.1f;
+    return glm::ortho(lightMin.x, lightMax.x, lightMin.y, lightMax.y, nearPlane, farPlane);
+}
+
+// remembers what the shadow map was last rendered from, so the depth pass can be skipped while nothing
+// moves and limited to the texels of the casters that did otherwise. casters are identified by the asset
+// they draw and their transform, a moved caster is one that disappeared from its old place and appeared
+// at the new one, so both its old and new light space bounds are redrawn.
+class ShadowCache
+{
+public:
+    // forces a full redraw, e.g. after the depth texture was reallocated
+    void invalidate()
+    {
+        valid = false;
+    }
+
+    // starts listing the casters of this frame
+    void begin()
+    {
+        casters.clear();
+    }
+
+    // asset is anything that identifies what is drawn, boundsMin/boundsMax the world space box of the caster
+    void addCaster(const void *asset, const glm::mat4 &transform, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+    {
+        uint64_t key = HashBytes(&asset, sizeof(asset));
+        key = HashBytes(&transform, sizeof(transform), key);
+        casters.push_back({ key, boundsMin, boundsMax });
+    }
+
+    // compares the casters listed since begin() and the light with the last update and returns what to redraw
+    // in a width x height shadow map. the cache assumes the caller redraws that region before the next update.
+    ShadowRegion update(const glm::mat4 &lightSpaceMatrix, int width, int height)
+    {
+        std::sort(casters.begin(), casters.end(), [](const Caster &a, const Caster &b) { return a.key < b.key; });
+
+        ShadowRegion region;
+        if (!valid || lightSpaceMatrix != lightSpace || width != mapWidth || height != mapHeight)
+        {
+            region.redraw = region.full = true;
+            region.width = width;
+            region.height = height;
+        }
+        else
+        {
+            // merge both sorted lists, everything present in only one of them changed
+            glm::vec2 dirtyMin(1e30f), dirtyMax(-1e30f);
+            size_t i = 0, j = 0;
+            while (i < casters.size() || j < previous.size())
+            {
+                if (j == previous.size() || (i < casters.size() && casters[i].key < previous[j].key))
+                    growRegion(casters[i++], lightSpaceMatrix, dirtyMin, dirtyMax);
+                else if (i == casters.size() || previous[j].key < casters[i].key)
+                    growRegion(previous[j++], lightSpaceMatrix, dirtyMin, dirtyMax);
+                else
+                    i++, j++;
+            }
+            if (dirtyMin.x < dirtyMax.x && dirtyMin.y < dirtyMax.y)
+            {
+                // to texels, padded by one for the rasterization of edges crossing the border
+                int x0 = std::max(0, static_cast<int>(std::floor((dirtyMin.x * 0.5f + 0.5f) * width)) - 1);
+                int y0 = std::max(0, static_cast<int>(std::floor((dirtyMin.y * 0.5f + 0.5f) * height)) - 1);
+                int x1 = std::min(width, static_cast<int>(std::ceil((dirtyMax.x * 0.5f + 0.5f) * width)) + 1);
+                int y1 = std::min(height, static_cast<int>(std::ceil((dirtyMax.y * 0.5f + 0.5f) * height)) + 1);
+                if (x0 < x1 && y0 < y1)
+                {
+                    region.redraw = true;
+                    region.x = x0;
+                    region.y = y0;
+                    region.width = x1 - x0;
+                    region.height = y1 - y0;
+                    region.full = region.width == width && region.height == height;
+                }
+            }
+        }
+
+        valid = true;
+        lightSpace = lightSpaceMatrix;
+        mapWidth = width;
+        mapHeight = height;
+        previous.swap(casters);
+        return region;
+    }
+
+private:
+    struct Caster {
+        uint64_t key;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    std::vector<Caster> casters;
+    std::vector<Caster> previous;
+    glm::mat4 lightSpace = glm::mat4(1.0f);
+    int mapWidth = 0;
+    int mapHeight = 0;
+    bool valid = false;
+
+    // adds the light space footprint of the caster's bounds, clamped to the map, to the dirty rectangle (in NDC)
+    static void growRegion(const Caster &caster, const glm::mat4 &lightSpaceMatrix, glm::vec2 &dirtyMin, glm::vec2 &dirtyMax)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner(i & 1 ? caster.boundsMax.x : caster.boundsMin.x, i & 2 ? caster.boundsMax.y : caster.boundsMin.y,
+                i & 4 ? caster.boundsMax.z : caster.boundsMin.z);
+            glm::vec4 clip = lightSpaceMatrix * glm::vec4(corner, 1.0f);
+            glm::vec2 ndc = glm::clamp(glm::vec2(clip) / clip.w, glm::vec2(-1.0f), glm::vec2(1.0f));
+            dirtyMin = glm::min(dirtyMin, ndc);
+            dirtyMax = glm::max(dirtyMax, ndc);
+        }
+    }
+};
+#endif
@@ -0,0 +1,153 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <learnopengl/file_cache.h>
+#include <learnopengl/texture_streamer.h>
+
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+// one texture image shared by every model that references it. the GL texture is deleted together
+// with the last reference, so references must be dropped on the GL thread once the texture is uploaded.
+class SharedTexture
+{
+public:
+    SharedTexture(const std::string &path, const std::string &directory, bool gamma)
+        : path(path), directory(directory), gamma(gamma) {}
+
+    SharedTexture(const SharedTexture&) = delete;
+    SharedTexture& operator=(const SharedTexture&) = delete;
+
+    ~SharedTexture()
+    {
+        unsigned int textureID = id.load();
+        if (textureID)
+        {
+            TextureStreamer::instance().cancel(textureID);
+            glDeleteTextures(1, &textureID);
+        }
+        if (image.data)
+            stbi_image_free(image.data);
+    }
+
+    // GL texture name, 0 until upload() ran
+    unsigned int getID() const
+    {
+        return id.load();
+    }
+
+    // decodes the image on the calling thread, unless it is resident already or another thread is decoding it.
+    // an up to date bake is read instead of the source image, it needs neither decoding nor mipmapping.
+    void decode()
+    {
+        std::unique_lock<std::mutex> lock(imageMutex, std::try_to_lock);
+        if (!lock.owns_lock() || decoded || id.load())
+            return;
+        auto baked = std::make_shared<CompressedTexture>();
+        if (LoadCompressedTexture(path.c_str(), directory, *baked))
+            compressed = baked;
+        else
+            LoadTextureImage(path.c_str(), directory, image);
+        decoded = true;
+    }
+
+    // creates the GL texture and returns its name. GL thread only. the texture shows a placeholder until the
+    // TextureStreamer made the image resident, which decodes it in the background if no loader thread did.
+    unsigned int upload()
+    {
+        std::lock_guard<std::mutex> lock(imageMutex);
+        if (id.load())
+            return id.load();
+        id = TextureStreamer::instance().stream(path, directory, decoded ? image : TextureImage(), compressed);
+        image = TextureImage(); // owned by the streamer now
+        compressed.reset();
+        decoded = false;
+        return id.load();
+    }
+
+private:
+    std::string path;
+    std::string directory;
+    bool gamma;
+
+    std::atomic<unsigned int> id{0};
+    std::mutex imageMutex;
+    TextureImage image;
+    CompressedTexturePtr compressed;
+    bool decoded = false;
+};
+
+// process wide registry of the loaded textures. lookups are hashed by canonical absolute path and, for
+// images that are copied between model folders, by file content, so every image is decoded and uploaded once.
+class TextureCache
+{
+public:
+    static TextureCache &instance()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // returns the shared texture of path (relative to directory), registering it on first use. thread safe.
+    std::shared_ptr<SharedTexture> acquire(const std::string &path, const std::string &directory, bool gamma = false)
+    {
+        std::error_code error;
+        std::filesystem::path filename = std::filesystem::path(directory) / path;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(filename, error);
+        std::string key = (error ? std::filesystem::absolute(filename) : canonical).generic_string();
+
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            auto it = byPath.find(key);
+            if (it != byPath.end())
+                if (std::shared_ptr<SharedTexture> texture = it->second.lock())
+                    return texture;
+        }
+
+        // hash the file outside the lock, it is cheap compared to decoding but not free
+        FileStamp stamp;
+        bool hashed = GetFileStamp(key, stamp);
+        uint64_t contentKey = HashBytes(&stamp.size, sizeof(stamp.size), stamp.contentHash);
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        std::weak_ptr<SharedTexture> &pathSlot = byPath[key];
+        if (std::shared_ptr<SharedTexture> texture = pathSlot.lock())
+            return texture; // another loader registered it in the meantime
+        if (hashed)
+        {
+            auto it = byContent.find(contentKey);
+            if (it != byContent.end())
+            {
+                if (std::shared_ptr<SharedTexture> texture = it->second.lock())
+                {
+                    pathSlot = texture;
+                    return texture;
+                }
+            }
+        }
+
+        auto texture = std::make_shared<SharedTexture>(path, directory, gamma);
+        pathSlot = texture;
+        if (hashed)
+            byContent[contentKey] = texture;
+        return texture;
+    }
+
+private:
+    std::mutex registryMutex;
+    std::unordered_map<std::string, std::weak_ptr<SharedTexture>> byPath;
+    std::unordered_map<uint64_t, std::weak_ptr<SharedTexture>> byContent;
+
+    TextureCache() = default;
+};
+
+#endif
@@ -0,0 +1,403 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <learnopengl/compressed_texture.h>
+#include <learnopengl/thread_pool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+// decoded pixels of a texture file, filled on a loader thread and uploaded later on the GL thread
+struct TextureImage {
+    unsigned char *data = nullptr;
+    int width = 0;
+    int height = 0;
+    int nrComponents = 0;
+};
+
+bool LoadTextureImage(const char *path, const std::string &directory, TextureImage &image);
+unsigned int UploadTextureImage(TextureImage &image, bool gamma = false);
+
+typedef std::shared_ptr<TextureImage> TextureImagePtr;
+typedef std::shared_ptr<CompressedTexture> CompressedTexturePtr;
+
+// what a loader thread produced for one texture: the baked DXT levels when an up to date bake exists, pixels otherwise
+struct DecodedTexture {
+    TextureImagePtr image;
+    CompressedTexturePtr compressed;
+};
+
+// Streams textures to the GPU in the background. A texture is usable right away but shows a 1x1 white
+// placeholder; its image is decoded on the thread pool and copied into a pixel buffer object a few MB per
+// frame. Once staged, a single glTexImage2D sources the PBO so the transfer and mipmapping stay on the GPU.
+// Baked textures skip decoding and mipmapping: their DXT levels are staged as they are and defined per level.
+class TextureStreamer
+{
+public:
+    static TextureStreamer &instance()
+    {
+        static TextureStreamer streamer;
+        return streamer;
+    }
+
+    // workers used for decoding, without a pool images are decoded on the GL thread in update()
+    void setThreadPool(ThreadPool *pool)
+    {
+        decodePool = pool;
+    }
+
+    // bytes copied into staging buffers per update(), bounds the loading cost of a single frame
+    void setFrameBudget(size_t bytes)
+    {
+        frameBudget = std::max<size_t>(bytes, 1);
+    }
+
+    // creates the texture showing the placeholder and queues the real image. image may already hold
+    // decoded pixels, whose ownership then passes to the streamer, or compressed the baked levels;
+    // otherwise the file gets loaded in the background.
+    unsigned int stream(const std::string &path, const std::string &directory, TextureImage image, CompressedTexturePtr compressed = nullptr)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // no mipmaps until the real image is in
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        Job job;
+        job.textureID = textureID;
+        if (compressed)
+        {
+            job.compressed = compressed;
+            if (image.data)
+                stbi_image_free(image.data);
+        }
+        else if (image.data)
+            job.image = wrapImage(image);
+        else if (decodePool)
+            job.decoding = decodePool->enqueue([path, directory] { return decodeTexture(path, directory); });
+        else
+        {
+            job.path = path;
+            job.directory = directory;
+        }
+        jobs.push_back(std::move(job));
+        return textureID;
+    }
+
+    // forgets a texture that is being deleted before it finished streaming
+    void cancel(unsigned int textureID)
+    {
+        for (auto it = jobs.begin(); it != jobs.end(); ++it)
+        {
+            if (it->textureID == textureID)
+            {
+                if (it->staging.pbo)
+                    freeBuffers.push_back(it->staging); // nothing was submitted from it yet
+                jobs.erase(it);
+                return;
+            }
+        }
+    }
+
+    // advances the queued textures within the frame budget, call once per frame on the GL thread
+    void update()
+    {
+        recycleBuffers();
+
+        size_t budget = frameBudget;
+        for (auto it = jobs.begin(); it != jobs.end() && budget > 0;)
+        {
+            Job &job = *it;
+            if (!job.image && !job.compressed)
+            {
+                DecodedTexture decoded;
+                if (job.decoding.valid())
+                {
+                    if (job.decoding.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    decoded = job.decoding.get();
+                }
+                else
+                    decoded = decodeTexture(job.path, job.directory);
+                job.image = decoded.image;
+                job.compressed = decoded.compressed;
+            }
+            if (!job.compressed && !job.image->data)
+            {
+                it = jobs.erase(it); // the file could not be decoded, keep showing the placeholder
+                continue;
+            }
+
+            const unsigned char *source = job.compressed ? job.compressed->data.data() : job.image->data;
+            const size_t total = job.compressed ? job.compressed->data.size() : imageSize(*job.image);
+            if (!job.staging.pbo)
+                job.staging = acquireBuffer(total);
+
+            const size_t chunk = std::min(budget, total - job.staged);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.staging.pbo);
+            void *target = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, job.staged, chunk,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            if (target)
+            {
+                std::memcpy(target, source + job.staged, chunk);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                job.staged += chunk;
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            budget -= chunk;
+            if (!target)
+                break;
+
+            if (job.staged == total)
+            {
+                finish(job);
+                it = jobs.erase(it);
+            }
+        }
+    }
+
+    // true while textures are still waiting for their real image
+    bool isBusy() const
+    {
+        return !jobs.empty();
+    }
+
+    size_t pendingCount() const
+    {
+        return jobs.size();
+    }
+
+    // drops the queue and deletes the staging buffers, call before the GL context goes away
+    void shutdown()
+    {
+        for (Job &job : jobs)
+            if (job.staging.pbo)
+                freeBuffers.push_back(job.staging);
+        jobs.clear();
+        for (StagingBuffer &buffer : retiringBuffers)
+        {
+            glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(buffer.fence);
+            freeBuffers.push_back(buffer);
+        }
+        retiringBuffers.clear();
+        for (StagingBuffer &buffer : freeBuffers)
+            glDeleteBuffers(1, &buffer.pbo);
+        freeBuffers.clear();
+        decodePool = nullptr;
+    }
+
+private:
+    // a pixel buffer object of the staging pool, fence guards its reuse until the GPU read it
+    struct StagingBuffer {
+        GLuint pbo = 0;
+        size_t size = 0;
+        GLsync fence = 0;
+    };
+
+    struct Job {
+        unsigned int textureID = 0;
+        std::string path;       // only set when the image is decoded in update()
+        std::string directory;
+        std::future<DecodedTexture> decoding;
+        TextureImagePtr image;
+        CompressedTexturePtr compressed;
+        StagingBuffer staging;
+        size_t staged = 0;      // bytes of the image copied into the staging buffer so far
+    };
+
+    static const size_t maxFreeBuffers = 4;
+
+    ThreadPool *decodePool = nullptr;
+    size_t frameBudget = 8 * 1024 * 1024;
+    std::list<Job> jobs;
+    std::vector<StagingBuffer> freeBuffers;
+    std::vector<StagingBuffer> retiringBuffers;
+
+    TextureStreamer() = default;
+
+    static TextureImagePtr wrapImage(const TextureImage &image)
+    {
+        return TextureImagePtr(new TextureImage(image), [](TextureImage *decoded) {
+            if (decoded->data)
+                stbi_image_free(decoded->data);
+            delete decoded;
+        });
+    }
+
+    static DecodedTexture decodeTexture(const std::string &path, const std::string &directory)
+    {
+        DecodedTexture decoded;
+        auto compressed = std::make_shared<CompressedTexture>();
+        if (LoadCompressedTexture(path.c_str(), directory, *compressed))
+        {
+            decoded.compressed = compressed;
+            return decoded;
+        }
+        TextureImage image;
+        LoadTextureImage(path.c_str(), directory, image);
+        decoded.image = wrapImage(image);
+        return decoded;
+    }
+
+    static size_t imageSize(const TextureImage &image)
+    {
+        return static_cast<size_t>(image.width) * image.height * image.nrComponents;
+    }
+
+    static GLenum imageFormat(const TextureImage &image)
+    {
+        if (image.nrComponents == 1)
+            return GL_RED;
+        if (image.nrComponents == 3)
+            return GL_RGB;
+        return GL_RGBA;
+    }
+
+    StagingBuffer acquireBuffer(size_t size)
+    {
+        // take the smallest free buffer that fits, otherwise grow the pool
+        auto best = freeBuffers.end();
+        for (auto it = freeBuffers.begin(); it != freeBuffers.end(); ++it)
+            if (it->size >= size && (best == freeBuffers.end() || it->size < best->size))
+                best = it;
+        if (best != freeBuffers.end())
+        {
+            StagingBuffer buffer = *best;
+            freeBuffers.erase(best);
+            return buffer;
+        }
+
+        StagingBuffer buffer;
+        buffer.size = size;
+        glGenBuffers(1, &buffer.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return buffer;
+    }
+
+    // moves buffers whose transfer completed back into the pool
+    void recycleBuffers()
+    {
+        for (auto it = retiringBuffers.begin(); it != retiringBuffers.end();)
+        {
+            GLenum status = glClientWaitSync(it->fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(it->fence);
+                it->fence = 0;
+                freeBuffers.push_back(*it);
+                it = retiringBuffers.erase(it);
+            }
+            else
+                ++it;
+        }
+        // keep the larger buffers around, drop the rest
+        std::sort(freeBuffers.begin(), freeBuffers.end(), [](const StagingBuffer &a, const StagingBuffer &b) { return a.size > b.size; });
+        while (freeBuffers.size() > maxFreeBuffers)
+        {
+            glDeleteBuffers(1, &freeBuffers.back().pbo);
+            freeBuffers.pop_back();
+        }
+    }
+
+    // defines the real image from the staging buffer and retires the buffer behind a fence
+    void finish(Job &job)
+    {
+        glBindTexture(GL_TEXTURE_2D, job.textureID);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.staging.pbo);
+        if (job.compressed)
+        {
+            // every level was baked offline, the PBO holds them back to back
+            const CompressedTexture &texture = *job.compressed;
+            for (size_t i = 0; i < texture.levels.size(); i++)
+            {
+                const CompressedLevel &level = texture.levels[i];
+                glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), texture.format, level.width, level.height, 0,
+                    static_cast<GLsizei>(level.size), reinterpret_cast<void*>(static_cast<uintptr_t>(level.offset)));
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(texture.levels.size()) - 1);
+        }
+        else
+        {
+            const GLenum format = imageFormat(*job.image);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, format, job.image->width, job.image->height, 0, format, GL_UNSIGNED_BYTE, (void*)0);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+        job.staging.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        retiringBuffers.push_back(job.staging);
+        job.staging = StagingBuffer();
+    }
+};
+
+bool LoadTextureImage(const char *path, const std::string &directory, TextureImage &image)
+{
+    std::string filename = std::string(path);
+    filename = directory + '/' + filename;
+
+    image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.nrComponents, 0);
+    if (!image.data)
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// uploads a decoded image into a new texture object and frees its pixels, must run on the GL thread
+unsigned int UploadTextureImage(TextureImage &image, bool gamma)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    if (image.data)
+    {
+        GLenum format;
+        if (image.nrComponents == 1)
+            format = GL_RED;
+        else if (image.nrComponents == 3)
+            format = GL_RGB;
+        else if (image.nrComponents == 4)
+            format = GL_RGBA;
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        stbi_image_free(image.data);
+        image.data = nullptr;
+    }
+
+    return textureID;
+}
+#endif
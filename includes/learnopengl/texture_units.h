@@ -0,0 +1,101 @@
+#ifndef TEXTURE_UNITS_H
+#define TEXTURE_UNITS_H
+
+#include <glad/glad.h>
+
+#include <string_view>
+#include <vector>
+
+// every sampler has a fixed texture unit, so programs are configured once at link time and drawing only binds textures.
+// unit 0 is left to code that binds textures for uploads or one off passes, the shadow map has its own unit.
+#define SHADOW_MAP_TEXTURE_UNIT 1
+#define MATERIAL_TEXTURE_UNIT_BASE 2
+#define MAX_TEXTURES_PER_TYPE 3
+
+// what a material texture is used for, its sampler in the shaders is named texture_<type>N with N counting from 1
+enum TextureType {
+    TEXTURE_DIFFUSE,
+    TEXTURE_SPECULAR,
+    TEXTURE_NORMAL,
+    TEXTURE_HEIGHT,
+    TEXTURE_TYPE_COUNT
+};
+
+// the buffer textures of clustered lighting (see light_clusters.h) follow the material units
+#define LIGHT_DATA_TEXTURE_UNIT (MATERIAL_TEXTURE_UNIT_BASE + TEXTURE_TYPE_COUNT * MAX_TEXTURES_PER_TYPE)
+#define CLUSTER_GRID_TEXTURE_UNIT (LIGHT_DATA_TEXTURE_UNIT + 1)
+#define CLUSTER_LIGHTS_TEXTURE_UNIT (LIGHT_DATA_TEXTURE_UNIT + 2)
+
+// sampler name prefix of type, also how the type is stored in the mesh cache
+inline const char *TextureTypeName(TextureType type)
+{
+    switch (type)
+    {
+    case TEXTURE_DIFFUSE:  return "texture_diffuse";
+    case TEXTURE_SPECULAR: return "texture_specular";
+    case TEXTURE_NORMAL:   return "texture_normal";
+    case TEXTURE_HEIGHT:   return "texture_height";
+    default:               return "";
+    }
+}
+
+inline bool TextureTypeFromName(std::string_view name, TextureType &type)
+{
+    for (int i = 0; i < TEXTURE_TYPE_COUNT; i++)
+    {
+        if (name == TextureTypeName(static_cast<TextureType>(i)))
+        {
+            type = static_cast<TextureType>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// unit of the index-th (0 based) texture of type, -1 if the shaders have no sampler that far
+inline int MaterialTextureUnit(TextureType type, unsigned int index)
+{
+    if (type >= TEXTURE_TYPE_COUNT || index >= MAX_TEXTURES_PER_TYPE)
+        return -1;
+    return MATERIAL_TEXTURE_UNIT_BASE + type * MAX_TEXTURES_PER_TYPE + static_cast<int>(index);
+}
+
+// unit of a sampler named like "texture_specular2", -1 if it isn't a material sampler
+inline int MaterialSamplerUnit(std::string_view name)
+{
+    size_t digits = name.find_last_not_of("0123456789") + 1;
+    if (digits == 0 || digits == name.size() || name.size() - digits > 2)
+        return -1;
+    TextureType type;
+    if (!TextureTypeFromName(name.substr(0, digits), type))
+        return -1;
+    unsigned int number = 0;
+    for (char c : name.substr(digits))
+        number = number * 10 + static_cast<unsigned int>(c - '0');
+    return number == 0 ? -1 : MaterialTextureUnit(type, number - 1);
+}
+
+// points every material sampler of a freshly linked program at its unit
+inline void BindMaterialSamplers(GLuint program)
+{
+    GLint count = 0, maxLength = 0, previous = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+    glUseProgram(program);
+    for (GLint i = 0; i < count; i++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program, static_cast<GLuint>(i), static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+        if (type != GL_SAMPLER_2D)
+            continue;
+        int unit = MaterialSamplerUnit(std::string_view(name.data(), length));
+        if (unit >= 0)
+            glUniform1i(glGetUniformLocation(program, name.data()), unit);
+    }
+    glUseProgram(static_cast<GLuint>(previous));
+}
+#endif
@@ -0,0 +1,50 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// a uniform buffer bound to a fixed binding point and shared by every program whose block is bound to it
+// (see Shader::bindUniformBlock). T has to mirror the std140 layout of the block, vec3 members padded to 16 bytes.
+template <typename T>
+class UniformBuffer
+{
+public:
+    unsigned int ID;
+
+    explicit UniformBuffer(GLuint binding) : binding(binding)
+    {
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    // uploads data, skipped when it is identical to the last upload (e.g. nothing moved since the last frame)
+    void update(const T &data)
+    {
+        if (uploaded && std::memcmp(&data, &current, sizeof(T)) == 0)
+            return;
+        current = data;
+        uploaded = true;
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &current);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    GLuint getBinding() const
+    {
+        return binding;
+    }
+
+private:
+    GLuint binding;
+    T current;
+    bool uploaded = false;
+};
+#endif
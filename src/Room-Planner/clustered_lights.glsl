@@ -0,0 +1,34 @@
+// the point lights of the room, sorted into the clusters of the view frustum on the CPU every frame (see
+// light_clusters.h). needs frame_data.glsl, the CLUSTER_* sizes are defined by the program.
+uniform samplerBuffer lightData;      // two texels per light: position and radius, colour times intensity
+uniform usamplerBuffer clusterGrid;   // per cluster: first entry in clusterLights and the number of lights
+uniform usamplerBuffer clusterLights; // light indices, one cluster after the other
+
+// phong lighting by the point lights reaching the fragment's cluster, none of them casts a shadow
+vec3 ClusteredLighting(vec3 fragPos, vec3 normal, vec3 viewDir, float specular, float exponent)
+{
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int slice = clamp(int(log(max(depth, 1e-4)) * clusterSliceScale + clusterSliceBias), 0, CLUSTER_Z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    uvec2 cluster = texelFetch(clusterGrid, (slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < cluster.y; i++)
+    {
+        int light = int(texelFetch(clusterLights, int(cluster.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, light * 2);
+        vec3 color = texelFetch(lightData, light * 2 + 1).rgb;
+
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float distance = length(toLight);
+        // inverse square falloff windowed to reach zero at the radius, which is what the clusters were culled with
+        float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+
+        vec3 lightDir = toLight / max(distance, 1e-4);
+        float diff = max(dot(normal, lightDir), 0.0);
+        float spec = pow(max(dot(viewDir, reflect(-lightDir, normal)), 0.0), exponent);
+        result += (diff + specular * spec) * attenuation * color;
+    }
+    return result;
+}
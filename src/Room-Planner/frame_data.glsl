@@ -0,0 +1,19 @@
+// per frame data, shared by all programs through one uniform buffer. keep in sync with FrameData in main.cpp
+layout (std140) uniform FrameData
+{
+    mat4 projection;
+    mat4 view;
+    mat4 lightSpaceMatrix;
+    vec3 viewPos;
+    float ambientStrength;
+    vec3 lightPos1;
+    float specularStrength;
+    vec3 lightColor1;
+    float shininess;
+    vec3 lightPos2;
+    vec3 lightColor2;
+    vec3 objectColor;
+    vec2 clusterTileSize;    // pixels per cluster tile, see clustered_lights.glsl
+    float clusterSliceScale; // depth slice = log(view depth) * scale + bias
+    float clusterSliceBias;
+};
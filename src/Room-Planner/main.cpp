@@ -13,8 +13,23 @@
 #include <learnopengl/shader_m.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
-
+#include <learnopengl/entity.h>
+#include <learnopengl/model_catalog.h>
+#include <learnopengl/light_clusters.h>
+#include <learnopengl/occlusion_query.h>
+#include <learnopengl/render_queue.h>
+#include <learnopengl/shadow_cache.h>
+#include <learnopengl/texture_streamer.h>
+#include <learnopengl/thread_pool.h>
+#include <learnopengl/uniform_buffer.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
 #include <filesystem>
+#include <limits>
+#include <memory>
+#include <new>
 #include <stdexcept>
 
 #include <iostream>
@@ -23,12 +38,26 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void mouse_btn_callback(GLFWwindow* window, int button, int action, int mods);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void window_focus_callback(GLFWwindow* window, int focused);
+void window_refresh_callback(GLFWwindow* window);
+void requestFrames();
 void processInput(GLFWwindow* window);
 void changeImguiMode(GLFWwindow* window);
-AABB calculateAABB(std::vector<Mesh>& meshes);
 void changeCurrentModel(const std::string& direction);
 std::vector<std::string> getFilesInDirectory(const std::string& directory);
+int bakeTextures(const std::string& directory);
 void resetApplication(GLFWwindow* window);
+glm::mat4 getModelMatrix(const ModelData& model, const glm::vec3& offset);
+void buildInstanceBatches(const glm::vec3& offset);
+struct CullingStats;
+struct LodSelection;
+void drawInstanceBatches(Shader& shader, const Frustum& frustum, const LodSelection& lodSelection, CullingStats& stats, RenderQueueStats& queueStats, bool bindTextures, bool skipOccluded);
+void queueInstanceBatches(Shader& shader, const Frustum& frustum, const LodSelection& lodSelection, CullingStats& stats, bool skipOccluded);
+void submitInstanceBatches(RenderQueueStats& queueStats, bool bindTextures, const Shader* program = nullptr);
+bool collectOcclusion();
+bool occlusionPending();
+void queryOcclusion(Shader& shader, const glm::vec3& eye);
 // settings
 const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1080;
@@ -54,16 +83,129 @@ int newModels = 0;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+// idle mode: once nothing changed for a few frames the loop sleeps in glfwWaitEventsTimeout instead of
+// rendering the same image again. events, held keys and background loading keep it rendering.
+const int settleFrames = 3;             // ImGui needs a few frames to settle after an event
+const double idleWaitTimeout = 0.25;    // upper bound of the sleep, in seconds
+const double occlusionPollTimeout = 0.01; // the sleep while occlusion results of the last frames are still on their way
+int framesToRender = settleFrames;
+int keysDown = 0;
+unsigned long long renderedFrames = 0;
+
 //models
 std::vector<ModelData> models;
 //current model -> used to move the current model using wasd when not in camera mode
 ModelData currentModel = {};
 int currentModelIndex = -1;
+unsigned int nextModelId = 1;
+// placed models grouped by the asset they share, each group is drawn with one instanced call per mesh
+struct InstanceBatch {
+    explicit InstanceBatch(std::shared_ptr<const Model> model) : model(std::move(model)) {}
+
+    std::shared_ptr<const Model> model;
+    std::vector<InstanceData> instances; // every placed instance
+    std::vector<AABB> bounds;           // their world space bounds, same order
+    std::vector<InstanceData> visible;  // instances that passed culling in the pass being drawn
+    std::vector<unsigned char> visibleLods; // the detail level picked for each of them
+    std::vector<InstanceData> byLod;    // the visible instances grouped by detail level, as uploaded
+    OcclusionQueries occlusion;         // per instance, whether its bounds were hidden the last time they were tested
+    std::vector<unsigned int> inFrustum; // instances inside the camera's frustum, tested again after the frame
+    std::vector<unsigned int> ids;      // ModelData::id of every instance, same order
+    std::vector<unsigned int> queriedIds; // the instances the occlusion results belong to, same order
+};
+std::vector<InstanceBatch> instanceBatches;
+// frustum culling results of the last frame, per pass
+struct CullingStats {
+    int visible = 0;
+    int culled = 0;
+    int occluded = 0;  // inside the frustum, but hidden behind the walls or other models
+    int lods[MESH_MAX_LODS] = {};  // visible instances drawn at each detail level
+};
+CullingStats cameraCulling, shadowCulling;
+// how coarse a detail level a pass may draw: the simplification error of the level, projected into the
+// target, has to stay below maxPixelError pixels (or shadow map texels)
+struct LodSelection {
+    bool perspective;    // orthographic otherwise
+    glm::vec3 eye;
+    float pixelsPerUnit; // pixels a unit long segment covers, at distance 1 for perspective projections
+    float maxPixelError;
+};
+// the shadow map is blurred by the filter anyway, so the depth pass gets away with coarser levels
+float lodPixelError = 1.0f;
+float shadowLodTexelError = 2.0f;
+// skip the models whose bounds the walls and the other models hid in the last frame
+bool occlusionCulling = true;
+unsigned int occlusionBoxVAO = 0;
+// lay down the depth of the models first, so the lit pass shades every pixel once however many models overlap
+bool depthPrepass = false;
+RenderQueueStats prepassQueueStats;
+// draws of the current pass, sorted to save binds, and what that saved in the last frame
+RenderQueue renderQueue;
+RenderQueueStats cameraQueueStats, shadowQueueStats;
+// the shadow map is kept until the light or a caster changes, then only the changed region is drawn again
+ShadowCache shadowCache;
+ShadowRegion shadowRedraw;
+// shadow map resolution presets, the light frustum is fitted to the room so every preset covers just the scene
+const char* shadowQualityNames[] = { "Low", "Medium", "High", "Ultra" };
+const unsigned int shadowQualitySizes[] = { 512, 1024, 2048, 4096 };
+int shadowQuality = 1;
+// taps per side of the shadow filter, each one a hardware filtered 2x2 comparison (see shadow.glsl)
+const int shadowKernelSize = 2;
+// mirrors the std140 FrameData block of the shaders, uploaded once per frame and only if something changed
+#define FRAME_DATA_BINDING 0
+struct FrameData {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::mat4 lightSpaceMatrix;
+    glm::vec3 viewPos;
+    float ambientStrength;
+    glm::vec3 lightPos1;
+    float specularStrength;
+    glm::vec3 lightColor1;
+    float shininess;
+    glm::vec3 lightPos2;
+    float padding0;
+    glm::vec3 lightColor2;
+    float padding1;
+    glm::vec3 objectColor;
+    float padding2;
+    glm::vec2 clusterTileSize;
+    float clusterSliceScale;
+    float clusterSliceBias;
+};
+// lamps placed in the room on top of the two lights above, any number of them (see light_clusters.h)
+std::vector<PointLight> pointLights;
+int selectedLight = 0;
 bool walls_created = false;
 
+#ifndef NDEBUG
+// debug builds count the heap allocations of each thread, the draw loop asserts it makes none
+thread_local size_t threadAllocations = 0;
+void* operator new(std::size_t size) {
+    threadAllocations++;
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+#endif
 
-int main()
+
+int main(int argc, char** argv)
 {
+#ifdef NDEBUG
+    std::string objectsFolderPath = "resources/objects";
+#else
+    std::string objectsFolderPath = (FileSystem::getPath("resources/objects"));
+#endif
+    // --bake-textures compresses the catalog textures ahead of time and exits without opening a window
+    if (argc > 1 && std::string(argv[1]) == "--bake-textures")
+        return bakeTextures(objectsFolderPath);
 
     // glfw: initialize and configure
     // ------------------------------
@@ -92,6 +234,9 @@ int main()
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
     glfwSetMouseButtonCallback(window, mouse_btn_callback);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetWindowFocusCallback(window, window_focus_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
     // tell GLFW to capture our mouse
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -113,6 +258,8 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // baked DXT textures are only used when the driver exposes S3TC
+    TextureBaker::detectSupport();
 
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(true);
@@ -125,10 +272,21 @@ int main()
 
     // build and compile shaders
     // -------------------------
-    Shader wallShader("wall_vertex.vert", "wall_fragment.frag");
-    Shader modelShader("model_vertex.vert", "model_fragment.frag");
+    const std::string litDefines = "#define SHADOW_KERNEL_SIZE " + std::to_string(shadowKernelSize) + "\n" + LightClusters::defines();
+    Shader wallShader("wall_vertex.vert", "wall_fragment.frag", litDefines);
+    Shader modelShader("model_vertex.vert", "model_fragment.frag", litDefines);
     Shader simpleDepthShader("shadow_mapping.vert", "shadow_mapping.frag");
+    Shader depthPrepassShader("shadow_mapping.vert", "shadow_mapping.frag", "#define CAMERA_DEPTH\n");
     Shader debugShader("debug.vert", "debug.frag");
+    Shader occlusionShader("occlusion_box.vert", "shadow_mapping.frag");
+    // camera, light and material values are shared by the programs through one uniform buffer
+    UniformBuffer<FrameData> frameUniforms(FRAME_DATA_BINDING);
+    wallShader.bindUniformBlock("FrameData", frameUniforms.getBinding());
+    modelShader.bindUniformBlock("FrameData", frameUniforms.getBinding());
+    simpleDepthShader.bindUniformBlock("FrameData", frameUniforms.getBinding());
+    depthPrepassShader.bindUniformBlock("FrameData", frameUniforms.getBinding());
+    occlusionShader.bindUniformBlock("FrameData", frameUniforms.getBinding());
+    occlusionBoxVAO = CreateOcclusionBoxVAO();
 
     float length = 0.0f, width = 0.0f;
     //bool walls_created = false;
@@ -141,30 +299,19 @@ int main()
 
     glm::vec3 translate(glm::vec3(0.0f, 0.3f * 2.0f, 0.0f));
     // load models
-#ifdef NDEBUG
-    std::string objectsFolderPath = "resources/objects";
-#else
-    std::string objectsFolderPath = (FileSystem::getPath("resources/objects"));
-#endif
     std::vector<std::string> objectFiles = getFilesInDirectory(objectsFolderPath);
 
-    std::vector<ModelData> availableModels;
-    for (const auto& filePath : objectFiles) {
-        std::filesystem::path fullPath = std::filesystem::absolute(filePath);
+    // only list the catalog here, models are imported the first time they are added (or prefetched)
+    ThreadPool loaderPool;
+    ModelCatalog catalog(loaderPool);
+    catalog.scan(objectFiles, objectsFolderPath);
+    // textures decode on the same workers and stream to the GPU a few MB per frame
+    TextureStreamer::instance().setThreadPool(&loaderPool);
+    TextureStreamer::instance().setFrameBudget(8 * 1024 * 1024);
 
-
-        ModelData ourModel = {
-            Model(fullPath.generic_string()),
-            glm::vec3(0.0f),
-            0.0f,
-            glm::vec3(0.05f*1.0f),
-            true,
-        };
-
-        availableModels.push_back(ourModel);
-
-        //ourModel.boundingBox = calculateAABB(currentModel.model.meshes);
-    }
+    // the lamps are sorted into clusters on workers of their own, texture decoding would hold them up
+    ThreadPool lightPool(std::max(1u, std::thread::hardware_concurrency() / 2));
+    LightClusters lightClusters(&lightPool);
 
 
     // render loop
@@ -187,9 +334,10 @@ int main()
     float ambientStrength2 = 0.05f;
     float specularStrength2 = 0.25f;
     float shininess2 = 16.0f;
-    glm::mat4 modelMatrix;
 
-    const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+    unsigned int SHADOW_WIDTH = shadowQualitySizes[shadowQuality], SHADOW_HEIGHT = shadowQualitySizes[shadowQuality];
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
     unsigned int depthMapFBO;
     glGenFramebuffers(1, &depthMapFBO);
     // create depth texture
@@ -197,8 +345,11 @@ int main()
     glGenTextures(1, &depthMap);
     glBindTexture(GL_TEXTURE_2D, depthMap);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // sampled through sampler2DShadow: the texture unit compares and filters the results of four texels at once
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
@@ -210,16 +361,45 @@ int main()
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     
+    // material samplers got their units when the programs were linked, see texture_units.h
     modelShader.use();
-    modelShader.setInt("shadowMap", 1);
+    modelShader.setInt("shadowMap", SHADOW_MAP_TEXTURE_UNIT);
+    modelShader.setInt("lightData", LIGHT_DATA_TEXTURE_UNIT);
+    modelShader.setInt("clusterGrid", CLUSTER_GRID_TEXTURE_UNIT);
+    modelShader.setInt("clusterLights", CLUSTER_LIGHTS_TEXTURE_UNIT);
     wallShader.use();
-    wallShader.setInt("shadowMap", 1);
+    wallShader.setInt("shadowMap", SHADOW_MAP_TEXTURE_UNIT);
+    wallShader.setInt("lightData", LIGHT_DATA_TEXTURE_UNIT);
+    wallShader.setInt("clusterGrid", CLUSTER_GRID_TEXTURE_UNIT);
+    wallShader.setInt("clusterLights", CLUSTER_LIGHTS_TEXTURE_UNIT);
+    wallShader.setMat4("model", glm::mat4(1.0f));
+    wallShader.setMat3("normalMatrix", glm::mat3(1.0f));
 
     while (!glfwWindowShouldClose(window))
     {
-        
+        // sleep until an event arrives while there is nothing new to show
+        bool busy = keysDown > 0 || catalog.isLoading() || TextureStreamer::instance().isBusy();
+        // a query of the last frames can still reveal a model hidden so far, keep looking at the results until
+        // they are all in. nothing issues new queries meanwhile, so this ends.
+        bool queriesPending = occlusionCulling && occlusionPending();
+        if (busy || framesToRender > 0)
+            glfwPollEvents();
+        else
+            glfwWaitEventsTimeout(queriesPending ? occlusionPollTimeout : idleWaitTimeout);
+        if (!busy && framesToRender == 0 && queriesPending && collectOcclusion())
+            requestFrames();
+        if (!busy && framesToRender == 0) {
+            // woke up by the timeout or by an event that changes nothing, skip the frame
+            lastFrame = static_cast<float>(glfwGetTime());
+            continue;
+        }
+        if (framesToRender > 0)
+            framesToRender--;
+        renderedFrames++;
 
-        glfwPollEvents();
+        // upload the models whose background import finished, then stream pending textures within the budget
+        catalog.update();
+        TextureStreamer::instance().update();
 
         //initialize imgui window
         ImGui_ImplOpenGL3_NewFrame();
@@ -313,6 +493,51 @@ int main()
             }
 
             ImGui::TextColored(ImVec4(1.0f, 1.0f, 0.0f, 1.0f), "\n\nApplication avg %.3f ms/frame (%.1f FPS)\n\n", 1000.0f / io.Framerate, io.Framerate);
+            if (TextureStreamer::instance().isBusy())
+                ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Streaming %d textures...", static_cast<int>(TextureStreamer::instance().pendingCount()));
+            ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Camera: %d visible, %d culled, %d occluded", cameraCulling.visible, cameraCulling.culled, cameraCulling.occluded);
+            ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Shadow: %d visible, %d culled", shadowCulling.visible, shadowCulling.culled);
+            ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Camera LODs: %d / %d / %d / %d, shadow LODs: %d / %d / %d / %d",
+                cameraCulling.lods[0], cameraCulling.lods[1], cameraCulling.lods[2], cameraCulling.lods[3],
+                shadowCulling.lods[0], shadowCulling.lods[1], shadowCulling.lods[2], shadowCulling.lods[3]);
+            ImGui::SliderFloat("LOD error (px)", &lodPixelError, 0.0f, 8.0f);
+            // the cached shadow map was drawn with the old levels
+            if (ImGui::SliderFloat("Shadow LOD error (texels)", &shadowLodTexelError, 0.0f, 8.0f))
+                shadowCache.invalidate();
+            ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Camera: %d draws, %d program / %d VAO / %d texture binds (unsorted %d / %d / %d)",
+                cameraQueueStats.draws, cameraQueueStats.programChanges, cameraQueueStats.vaoChanges, cameraQueueStats.textureChanges,
+                cameraQueueStats.unsortedProgramChanges, cameraQueueStats.unsortedVaoChanges, cameraQueueStats.unsortedTextureChanges);
+            ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Shadow: %d draws, %d program / %d VAO binds (unsorted %d / %d)",
+                shadowQueueStats.draws, shadowQueueStats.programChanges, shadowQueueStats.vaoChanges,
+                shadowQueueStats.unsortedProgramChanges, shadowQueueStats.unsortedVaoChanges);
+            if (depthPrepass)
+                ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Depth pre-pass: %d draws", prepassQueueStats.draws);
+            ImGui::Checkbox("Depth pre-pass", &depthPrepass);
+            if (ImGui::Checkbox("Occlusion culling", &occlusionCulling)) {
+                // results of queries from before the switch would hide models for a frame
+                for (InstanceBatch& batch : instanceBatches)
+                    batch.queriedIds.clear();
+            }
+            if (ImGui::BeginCombo("Shadow quality", shadowQualityNames[shadowQuality])) {
+                for (int i = 0; i < IM_ARRAYSIZE(shadowQualityNames); i++) {
+                    if (static_cast<GLint>(shadowQualitySizes[i]) > maxTextureSize)
+                        continue;
+                    if (ImGui::Selectable(shadowQualityNames[i], i == shadowQuality) && i != shadowQuality) {
+                        // reallocate the depth texture, the shadow cache sees the new size and redraws it all
+                        shadowQuality = i;
+                        SHADOW_WIDTH = SHADOW_HEIGHT = shadowQualitySizes[i];
+                        glBindTexture(GL_TEXTURE_2D, depthMap);
+                        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+                        glBindTexture(GL_TEXTURE_2D, 0);
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Frames rendered: %llu (rendered on demand)", renderedFrames);
+            if (!shadowRedraw.redraw)
+                ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Shadow map: reused");
+            else
+                ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Shadow map: redrawn %s %dx%d", shadowRedraw.full ? "fully" : "region", shadowRedraw.width, shadowRedraw.height);
             
 
 
@@ -321,6 +546,36 @@ int main()
             ImGui::SliderFloat("Light position X", &lightPos1.x, -360.0f, 360.0f);
             ImGui::SliderFloat("Light position Y", &lightPos1.y, -360.0f, 360.0f);
             ImGui::SliderFloat("Light position Z", &lightPos1.z, -360.0f, 360.0f);
+            ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "Lamps: %u, at most %u per cluster, %d list entries, assigned in %.2f ms",
+                lightClusters.getLightCount(), lightClusters.getMaxLightsPerCluster(), static_cast<int>(lightClusters.getIndexCount()), lightClusters.getAssignMilliseconds());
+            if (ImGui::Button("Add lamp")) {
+                pointLights.push_back({ camera.Position + camera.Front * 2.0f, 4.0f, glm::vec3(1.0f, 0.85f, 0.6f), 4.0f });
+                selectedLight = static_cast<int>(pointLights.size()) - 1;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Add 64 test lamps")) {
+                // a grid of coloured spots under the ceiling of the room
+                float roomLength = walls_created ? length : 10.0f, roomWidth = walls_created ? width : 10.0f;
+                for (int i = 0; i < 64; i++) {
+                    glm::vec3 position(((i % 8) + 0.5f) / 8.0f * roomLength - roomLength / 2, 2.8f, ((i / 8) + 0.5f) / 8.0f * roomWidth - roomWidth / 2);
+                    glm::vec3 color = 0.5f + 0.5f * glm::cos(6.2831853f * (i / 64.0f + glm::vec3(0.0f, 0.33f, 0.67f)));
+                    pointLights.push_back({ position, 2.5f, color, 3.0f });
+                }
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Remove lamps")) {
+                pointLights.clear();
+                selectedLight = 0;
+            }
+            if (!pointLights.empty()) {
+                ImGui::SliderInt("Lamp", &selectedLight, 0, static_cast<int>(pointLights.size()) - 1);
+                selectedLight = std::clamp(selectedLight, 0, static_cast<int>(pointLights.size()) - 1);
+                PointLight& lamp = pointLights[selectedLight];
+                ImGui::DragFloat3("Lamp position", &lamp.position.x, 0.05f);
+                ImGui::ColorEdit3("Lamp colour", &lamp.color.x);
+                ImGui::SliderFloat("Lamp radius", &lamp.radius, 0.5f, 20.0f);
+                ImGui::SliderFloat("Lamp intensity", &lamp.intensity, 0.0f, 20.0f);
+            }
             if (ImGui::Button("Toggle anti-aliasing")) {
                 antialiasing = !antialiasing;
                 if (antialiasing)
@@ -329,38 +584,45 @@ int main()
             }
             if (walls_created) {
 
-                static const char* currentItem = nullptr;
-                if (ImGui::BeginCombo("Select Model", currentItem)) {
-                    for (const auto& model : availableModels) {
-                        bool isSelected = (currentItem == model.model.directory.c_str());
-                        if (ImGui::Selectable(model.model.directory.c_str(), isSelected)) {
-                            currentItem = model.model.directory.c_str();
+                static int currentItem = -1;
+                if (ImGui::BeginCombo("Select Model", currentItem >= 0 ? catalog.entry(currentItem).name.c_str() : nullptr)) {
+                    for (int i = 0; i < static_cast<int>(catalog.size()); i++) {
+                        bool isSelected = (currentItem == i);
+                        if (ImGui::Selectable(catalog.entry(i).name.c_str(), isSelected)) {
+                            currentItem = i;
                         }
+                        // start importing the highlighted entry in the background
+                        if (ImGui::IsItemHovered())
+                            catalog.prefetch(i);
 
                         if (isSelected)
                             ImGui::SetItemDefaultFocus();
                     }
                     ImGui::EndCombo();
                 }
+                if (currentItem >= 0)
+                    catalog.prefetch(currentItem);
                 // ImGui button to add the selected model
-                if (ImGui::Button("Add Model") && currentItem != nullptr) {
-                    // Find the selected model based on the file path
-                    auto it = std::find_if(availableModels.begin(), availableModels.end(),
-                        [&](const ModelData& model) { return model.model.directory == currentItem; });
-
-                    if (it != availableModels.end()) {
-                        models.push_back(*it);  // Add the selected model to the scene
+                if (ImGui::Button("Add Model") && currentItem >= 0) {
+                    ModelData ourModel = {
+                        catalog.acquire(currentItem),
+                        glm::vec3(0.0f),
+                        0.0f,
+                        glm::vec3(0.05f*1.0f),
+                        true,
+                        nextModelId++,
+                    };
+                    models.push_back(ourModel);  // Add the selected model to the scene
 
-                        if (!currentModel.valid) {
-                            currentModelIndex = 0;
-                            currentModel = models[currentModelIndex];
-                            models.erase(models.begin());
-                        }
-                        else if (currentModel.valid) {
-                            models.insert(models.begin() + currentModelIndex, currentModel);
-                            currentModel = models[currentModelIndex = models.size() - 1];
-                            models.erase(models.begin() + currentModelIndex);
-                        }
+                    if (!currentModel.valid) {
+                        currentModelIndex = 0;
+                        currentModel = models[currentModelIndex];
+                        models.erase(models.begin());
+                    }
+                    else if (currentModel.valid) {
+                        models.insert(models.begin() + currentModelIndex, currentModel);
+                        currentModel = models[currentModelIndex = models.size() - 1];
+                        models.erase(models.begin() + currentModelIndex);
                     }
                 }
                 if (currentModel.valid && ImGui::Button("Remove current model")) {
@@ -413,6 +675,7 @@ int main()
         // input
         // -----
         processInput(window);
+        buildInstanceBatches(translate);
 
         // render
         // ------
@@ -420,51 +683,104 @@ int main()
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 
+        // list the shadow casters and the box they span, the walls included
+        shadowCache.begin();
+        glm::vec3 sceneMin(std::numeric_limits<float>::max()), sceneMax(-std::numeric_limits<float>::max());
+        for (const InstanceBatch& batch : instanceBatches) {
+            for (size_t i = 0; i < batch.instances.size(); i++) {
+                glm::vec3 boundsMin = batch.bounds[i].center - batch.bounds[i].extents;
+                glm::vec3 boundsMax = batch.bounds[i].center + batch.bounds[i].extents;
+                shadowCache.addCaster(batch.model.get(), batch.instances[i].model, boundsMin, boundsMax);
+                sceneMin = glm::min(sceneMin, boundsMin);
+                sceneMax = glm::max(sceneMax, boundsMax);
+            }
+        }
+        if (walls_created) {
+            glm::vec3 roomMin(-length / 2, 0.0f, -width / 2), roomMax(length / 2, 3.0f, width / 2);
+            shadowCache.addCaster(&VAO_walls, glm::mat4(1.0f), roomMin, roomMax);
+            sceneMin = glm::min(sceneMin, roomMin);
+            sceneMax = glm::max(sceneMax, roomMax);
+        }
+
         glm::mat4 lightProjection, lightView;
         glm::mat4 lightSpaceMatrix;
         float near_plane = 1.0f, far_plane = 7.5f;
-        //lightProjection = glm::perspective(glm::radians(45.0f), (GLfloat)SHADOW_WIDTH / (GLfloat)SHADOW_HEIGHT, near_plane, far_plane); // note that if you use a perspective projection matrix you'll have to change the light position as the current light position isn't enough to reflect the whole scene
-        lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
         lightView = glm::lookAt(lightPos1, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
+        // fit the light frustum to the scene, the texels of the shadow map then all land on something
+        if (sceneMin.x <= sceneMax.x)
+            lightProjection = FitLightProjection(lightView, sceneMin, sceneMax, 0.5f, near_plane, far_plane);
+        else
+            lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
         lightSpaceMatrix = lightProjection * lightView;
-        // render scene from light's point of view
-        simpleDepthShader.use();
-        simpleDepthShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
 
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        
-        for (int i = 0; i < models.size(); i++) {
-            modelMatrix = glm::mat4(1.0f);
-            modelMatrix = glm::translate(modelMatrix, translate);
-            modelMatrix = glm::translate(modelMatrix, models[i].translate);
-            modelMatrix = glm::rotate(modelMatrix, glm::radians(models[i].rotate), glm::vec3(0.0f, 1.0f, 0.0f));
-            modelMatrix = glm::scale(modelMatrix, models[i].scale);	// it's a bit too big for our scene, so scale it down
-            simpleDepthShader.setMat4("model", modelMatrix);
-
-            models[i].model.Draw(simpleDepthShader);
-        }
-        // render the current model
-        if (currentModel.valid) {
-            modelMatrix = glm::mat4(1.0f);
-            modelMatrix = glm::translate(modelMatrix, translate);
-            modelMatrix = glm::translate(modelMatrix, currentModel.translate);
-            modelMatrix = glm::rotate(modelMatrix, glm::radians(currentModel.rotate), glm::vec3(0.0f, 1.0f, 0.0f));
-            modelMatrix = glm::scale(modelMatrix, currentModel.scale);	// it's a bit too big for our scene, so scale it down
-            simpleDepthShader.setMat4("model", modelMatrix);
-
-            currentModel.model.Draw(simpleDepthShader);
-        }
-        if (walls_created) {
-            simpleDepthShader.setMat4("model", glm::mat4(1.0f));
+        // view/projection transformations
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = camera.GetViewMatrix();
 
-            glBindVertexArray(VAO_walls);
-            glDrawArrays(GL_TRIANGLES, 0, wallVertices.size() / 3);
-            glBindVertexArray(0);
-        }
+        FrameData frameData = {};
+        frameData.projection = projection;
+        frameData.view = view;
+        frameData.lightSpaceMatrix = lightSpaceMatrix;
+        frameData.viewPos = camera.Position;
+        frameData.ambientStrength = ambientStrength1;
+        frameData.lightPos1 = lightPos1;
+        frameData.specularStrength = specularStrength1;
+        frameData.lightColor1 = lightColor1;
+        frameData.shininess = shininess1;
+        frameData.lightPos2 = lightPos2;
+        frameData.lightColor2 = lightColor2;
+        frameData.objectColor = objectColor;
+        // sort the lamps into the clusters of this view
+        lightClusters.setProjection(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f, glm::vec2(SCR_WIDTH, SCR_HEIGHT));
+        lightClusters.update(pointLights, view);
+        frameData.clusterTileSize = lightClusters.getTileSize();
+        frameData.clusterSliceScale = lightClusters.getSliceScale();
+        frameData.clusterSliceBias = lightClusters.getSliceBias();
+        frameUniforms.update(frameData);
+
+        // find out which part of the shadow map the casters that moved since the last frame cover
+        shadowRedraw = shadowCache.update(lightSpaceMatrix, SHADOW_WIDTH, SHADOW_HEIGHT);
+
+        // render scene from light's point of view, limited to the changed region
+        if (shadowRedraw.redraw) {
+            simpleDepthShader.use();
+
+            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+            // casters outside the region are culled with the frustum of the region
+            glm::mat4 regionCrop(1.0f);
+            if (!shadowRedraw.full) {
+                glEnable(GL_SCISSOR_TEST);
+                glScissor(shadowRedraw.x, shadowRedraw.y, shadowRedraw.width, shadowRedraw.height);
+                glm::vec2 size(2.0f * shadowRedraw.width / SHADOW_WIDTH, 2.0f * shadowRedraw.height / SHADOW_HEIGHT);
+                glm::vec2 center(2.0f * (shadowRedraw.x + 0.5f * shadowRedraw.width) / SHADOW_WIDTH - 1.0f,
+                    2.0f * (shadowRedraw.y + 0.5f * shadowRedraw.height) / SHADOW_HEIGHT - 1.0f);
+                regionCrop = glm::scale(glm::mat4(1.0f), glm::vec3(2.0f / size.x, 2.0f / size.y, 1.0f)) *
+                    glm::translate(glm::mat4(1.0f), glm::vec3(-center, 0.0f));
+            }
+            glClear(GL_DEPTH_BUFFER_BIT);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            // every placed model inside the light's frustum, current one included, with one instanced draw per asset
+            // texels per world unit of the light's orthographic projection
+            float shadowTexelsPerUnit = 0.5f * std::min(lightProjection[0][0] * SHADOW_WIDTH, lightProjection[1][1] * SHADOW_HEIGHT);
+            LodSelection shadowLods = { false, lightPos1, shadowTexelsPerUnit, shadowLodTexelError };
+            drawInstanceBatches(simpleDepthShader, createFrustumFromMatrix(regionCrop * lightSpaceMatrix), shadowLods, shadowCulling, shadowQueueStats, false, false);
+            if (walls_created) {
+                // the walls have no instance buffer, their model matrix is the constant attribute value
+                SetInstanceMatrix(glm::mat4(1.0f));
+
+                glBindVertexArray(VAO_walls);
+                glDrawArrays(GL_TRIANGLES, 0, wallVertices.size() / 3);
+                glBindVertexArray(0);
+            }
+
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        else {
+            shadowCulling = CullingStats();
+            shadowQueueStats = RenderQueueStats();
+        }
 
         // reset viewport
         glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
@@ -476,24 +792,30 @@ int main()
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, depthMap);
 
-        // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
+        glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, depthMap);
+        glActiveTexture(GL_TEXTURE0);
+        lightClusters.bind();
+
+        // the models the camera can see, the current one included, are culled and uploaded once. both camera
+        // passes draw these packets, so the lit pass finds exactly the depth of the pre-pass
+        Frustum cameraFrustum = createFrustumFromCamera(camera, (float)SCR_WIDTH / (float)SCR_HEIGHT, glm::radians(camera.Zoom), 0.1f, 100.0f);
+        LodSelection cameraLods = { true, camera.Position, SCR_HEIGHT / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f)), lodPixelError };
+        if (occlusionCulling)
+            collectOcclusion();
+        queueInstanceBatches(modelShader, cameraFrustum, cameraLods, cameraCulling, occlusionCulling);
+
+        if (depthPrepass) {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            submitInstanceBatches(prepassQueueStats, false, &depthPrepassShader);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        }
+        else
+            prepassQueueStats = RenderQueueStats();
 
+        // the walls keep testing and writing depth as usual, where they cover a model its pre-pass depth is replaced
         if (walls_created) {
             wallShader.use();
-            wallShader.setMat4("projection", projection);
-            wallShader.setMat4("view", view);
-            wallShader.setMat4("model", glm::mat4(1.0f));
-            wallShader.setVec3("viewPos", camera.Position);
-
-            wallShader.setVec3("lightPos1", lightPos1);
-            wallShader.setVec3("lightColor1", lightColor1);
-
-            wallShader.setVec3("lightPos2", lightPos2);
-            wallShader.setVec3("lightColor2", lightColor2);
-
-            wallShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
 
             glBindVertexArray(VAO_walls);
             glDrawArrays(GL_TRIANGLES, 0, wallVertices.size() / 3);
@@ -501,45 +823,21 @@ int main()
         }
 
         modelShader.use();
-        modelShader.setMat4("projection", projection);
-        modelShader.setMat4("view", view);
-        modelShader.setVec3("viewPos", camera.Position);
-        modelShader.setVec3("objectColor", objectColor);
-
-        modelShader.setVec3("lightPos", lightPos1);
-        modelShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-        modelShader.setVec3("lightColor", lightColor1);
-        modelShader.setFloat("ambientStrength", ambientStrength1);
-        modelShader.setFloat("specularStrength", specularStrength1);
-        modelShader.setFloat("shininess", shininess1);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
         
         
 
-        // render the loaded models
-        glm::mat4 modelMatrix;
-        for (int i = 0; i < models.size(); i++) {
-            modelMatrix = glm::mat4(1.0f);
-            modelMatrix = glm::translate(modelMatrix, translate);
-            modelMatrix = glm::translate(modelMatrix, models[i].translate);
-            modelMatrix = glm::rotate(modelMatrix, glm::radians(models[i].rotate), glm::vec3(0.0f, 1.0f, 0.0f));
-            modelMatrix = glm::scale(modelMatrix, models[i].scale);	// it's a bit too big for our scene, so scale it down
-            modelShader.setMat4("model", modelMatrix);
-
-            models[i].model.Draw(modelShader);
-        }
-        // render the current model
-        if (currentModel.valid) {
-            modelMatrix = glm::mat4(1.0f);
-            modelMatrix = glm::translate(modelMatrix, translate);
-            modelMatrix = glm::translate(modelMatrix, currentModel.translate);
-            modelMatrix = glm::rotate(modelMatrix, glm::radians(currentModel.rotate), glm::vec3(0.0f, 1.0f, 0.0f));
-            modelMatrix = glm::scale(modelMatrix, currentModel.scale);	// it's a bit too big for our scene, so scale it down
-            modelShader.setMat4("model", modelMatrix);
-
-            currentModel.model.Draw(modelShader);
+        // after a pre-pass only the nearest surface of each pixel passes the depth test, and the depth buffer is
+        // already complete
+        if (depthPrepass) {
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
         }
+        submitInstanceBatches(cameraQueueStats, true);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        // test the bounds of everything in view against the finished depth buffer, the next frames use the results
+        if (occlusionCulling)
+            queryOcclusion(occlusionShader, camera.Position);
 
         
 
@@ -551,6 +849,13 @@ int main()
         glfwSwapBuffers(window);
     }
 
+    // release the models (and the textures they share) while the GL context still exists
+    models.clear();
+    currentModel = {};
+    instanceBatches.clear();
+    catalog.clear();
+    TextureStreamer::instance().shutdown();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -658,6 +963,7 @@ void changeCurrentModel(const std::string& direction) {
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
+    requestFrames();
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
@@ -668,6 +974,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 // -------------------------------------------------------
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 {
+    requestFrames();
     float xpos = static_cast<float>(xposIn);
     float ypos = static_cast<float>(yposIn);
 
@@ -691,6 +998,7 @@ void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 
 void mouse_btn_callback(GLFWwindow* window, int button, int action, int mods)
 {
+    requestFrames();
     if (button == GLFW_MOUSE_BUTTON_1 && action == GLFW_PRESS && (mods & GLFW_MOD_SHIFT)) {
         changeImguiMode(window);
     }
@@ -701,6 +1009,7 @@ void mouse_btn_callback(GLFWwindow* window, int button, int action, int mods)
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
+    requestFrames();
     if (imguiMode && currentModel.valid) {
 
         // if shift is held down, scroll is vertical translation
@@ -726,6 +1035,40 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 }
 
 
+// glfw: keys are polled in processInput, count the held ones so the loop keeps rendering while they move something
+// ----------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    requestFrames();
+    if (action == GLFW_PRESS)
+        keysDown++;
+    else if (action == GLFW_RELEASE && keysDown > 0)
+        keysDown--;
+}
+
+
+// releases are not reported to unfocused windows, so forget the held keys
+void window_focus_callback(GLFWwindow* window, int focused)
+{
+    requestFrames();
+    if (!focused)
+        keysDown = 0;
+}
+
+
+void window_refresh_callback(GLFWwindow* window)
+{
+    requestFrames();
+}
+
+
+// something may have changed, render until the UI settled
+void requestFrames()
+{
+    framesToRender = settleFrames;
+}
+
+
 void changeImguiMode(GLFWwindow* window)
 {
     imguiMode = !imguiMode;
@@ -741,30 +1084,6 @@ void changeImguiMode(GLFWwindow* window)
 }
 
 
-AABB calculateAABB(std::vector<Mesh>& meshes) {
-    glm::vec3 minCorner(std::numeric_limits<float>::max());
-    glm::vec3 maxCorner(std::numeric_limits<float>::lowest());
-
-    for each (Mesh m in meshes)
-    {
-        std::vector<Vertex> vertices = m.vertices;
-
-        for each (Vertex vertex in vertices) {
-            // Update the minimum corner
-            minCorner.x = std::min(minCorner.x, vertex.Position.x);
-            minCorner.y = std::min(minCorner.y, vertex.Position.y);
-            minCorner.z = std::min(minCorner.z, vertex.Position.z);
-
-            // Update the maximum corner
-            maxCorner.x = std::max(maxCorner.x, vertex.Position.x);
-            maxCorner.y = std::max(maxCorner.y, vertex.Position.y);
-            maxCorner.z = std::max(maxCorner.z, vertex.Position.z);
-        }
-    }
-    return AABB(minCorner, maxCorner);
-}
-
-
 std::vector<std::string> getFilesInDirectory(const std::string& directory) {
     std::vector<std::string> files;
     try {
@@ -781,6 +1100,255 @@ std::vector<std::string> getFilesInDirectory(const std::string& directory) {
 }
 
 
+// writes a DXT1/DXT5 bake with mipmaps of every RGB/RGBA texture below directory, textures load from it afterwards
+int bakeTextures(const std::string& directory) {
+    // bakes have to come out the way the loader would decode the source
+    stbi_set_flip_vertically_on_load(true);
+
+    std::vector<std::string> images;
+    try {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+            if (entry.is_regular_file() && TextureBaker::isImageFile(entry.path())) {
+                images.push_back(entry.path().string());
+            }
+        }
+    }
+    catch (const std::filesystem::filesystem_error& e) {
+        std::cerr << "Filesystem error: " << e.what() << std::endl;
+        return -1;
+    }
+
+    ThreadPool bakePool;
+    std::vector<std::future<BakeResult>> results;
+    for (const std::string& image : images) {
+        results.push_back(bakePool.enqueue([image] {
+            CompressedTexture existing;
+            return TextureBaker::load(image, existing) ? BAKED : TextureBaker::bake(image);
+        }));
+    }
+
+    int baked = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        BakeResult result = results[i].get();
+        if (result == BAKED) {
+            baked++;
+            std::cout << "Baked " << images[i] << std::endl;
+        }
+        else {
+            std::cout << "Skipped " << images[i] << " (" << BakeResultString(result) << ")" << std::endl;
+        }
+    }
+    std::cout << "Baked " << baked << " of " << images.size() << " textures into " << TextureBaker::directory() << std::endl;
+    return 0;
+}
+
+
+glm::mat4 getModelMatrix(const ModelData& model, const glm::vec3& offset) {
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    modelMatrix = glm::translate(modelMatrix, offset);
+    modelMatrix = glm::translate(modelMatrix, model.translate);
+    modelMatrix = glm::rotate(modelMatrix, glm::radians(model.rotate), glm::vec3(0.0f, 1.0f, 0.0f));
+    modelMatrix = glm::scale(modelMatrix, model.scale);	// it's a bit too big for our scene, so scale it down
+    return modelMatrix;
+}
+
+
+// regroups the placed models by asset and computes their model matrices and world space bounds
+void buildInstanceBatches(const glm::vec3& offset) {
+    for (InstanceBatch& batch : instanceBatches) {
+        batch.instances.clear();
+        batch.bounds.clear();
+        batch.ids.clear();
+    }
+
+    auto addInstance = [&offset](const ModelData& model) {
+        InstanceBatch* target = nullptr;
+        for (InstanceBatch& batch : instanceBatches) {
+            if (batch.model == model.model) {
+                target = &batch;
+                break;
+            }
+        }
+        if (!target) {
+            instanceBatches.emplace_back(model.model);
+            target = &instanceBatches.back();
+        }
+        // the bounds were computed once at import, only their transform changes
+        glm::mat4 modelMatrix = getModelMatrix(model, offset);
+        target->instances.push_back(InstanceData(modelMatrix));
+        target->bounds.push_back(transformAABB(AABB(model.model->boundsMin, model.model->boundsMax), modelMatrix));
+        target->ids.push_back(model.id);
+    };
+    for (const ModelData& model : models)
+        addInstance(model);
+    if (currentModel.valid)
+        addInstance(currentModel);
+
+    // forget assets that are no longer placed, the batch would keep them alive
+    instanceBatches.erase(std::remove_if(instanceBatches.begin(), instanceBatches.end(),
+        [](const InstanceBatch& batch) { return batch.instances.empty(); }), instanceBatches.end());
+
+    // room for everything a pass can produce, so drawing them never allocates
+    size_t packets = 0;
+    for (InstanceBatch& batch : instanceBatches) {
+        batch.visible.reserve(batch.instances.size());
+        batch.visibleLods.reserve(batch.instances.size());
+        batch.byLod.reserve(batch.instances.size());
+        batch.inFrustum.reserve(batch.instances.size());
+        packets += batch.model->meshes.size() * MESH_MAX_LODS;
+    }
+    renderQueue.reserve(packets);
+}
+
+
+// draws the instances whose bounds intersect frustum, each asset with one instanced call per mesh and detail level.
+// the calls of all assets go through the render queue, bindTextures is false for programs that sample no material texture.
+// with skipOccluded set, instances whose last occlusion query found them hidden are left out as well (see collectOcclusion).
+void drawInstanceBatches(Shader& shader, const Frustum& frustum, const LodSelection& lodSelection, CullingStats& stats, RenderQueueStats& queueStats, bool bindTextures, bool skipOccluded) {
+    queueInstanceBatches(shader, frustum, lodSelection, stats, skipOccluded);
+    submitInstanceBatches(queueStats, bindTextures);
+}
+
+
+// the first half of drawInstanceBatches: culls the instances, uploads the visible ones grouped by detail level and
+// fills the render queue with their draws, for one or more submitInstanceBatches calls in this frame.
+void queueInstanceBatches(Shader& shader, const Frustum& frustum, const LodSelection& lodSelection, CullingStats& stats, bool skipOccluded) {
+#ifndef NDEBUG
+    size_t allocationsBefore = threadAllocations;
+#endif
+    stats = CullingStats();
+    renderQueue.clear();
+    for (InstanceBatch& batch : instanceBatches) {
+        batch.visible.clear();
+        batch.visibleLods.clear();
+        batch.inFrustum.clear();
+        const int occludedBefore = stats.occluded;
+        for (size_t i = 0; i < batch.instances.size(); i++) {
+            if (!batch.bounds[i].isOnFrustum(frustum)) {
+                // a result from before it left the view says nothing about where it comes back
+                if (skipOccluded)
+                    batch.occlusion.markVisible(i);
+                continue;
+            }
+            if (skipOccluded) {
+                batch.inFrustum.push_back(static_cast<unsigned int>(i));
+                if (batch.occlusion.isOccluded(i)) {
+                    stats.occluded++;
+                    continue;
+                }
+            }
+            // the largest error allowed in object space: the target's error over what a unit covers there,
+            // measured from the nearest point of the bounding sphere and shrunk by the instance's largest scale
+            const glm::mat4& modelMatrix = batch.instances[i].model;
+            float scale = std::sqrt(std::max({ glm::dot(glm::vec3(modelMatrix[0]), glm::vec3(modelMatrix[0])),
+                glm::dot(glm::vec3(modelMatrix[1]), glm::vec3(modelMatrix[1])), glm::dot(glm::vec3(modelMatrix[2]), glm::vec3(modelMatrix[2])) }));
+            float pixelsPerUnit = lodSelection.pixelsPerUnit * scale;
+            if (lodSelection.perspective)
+                pixelsPerUnit /= std::max(glm::length(batch.bounds[i].center - lodSelection.eye) - glm::length(batch.bounds[i].extents), 0.1f);
+            batch.visible.push_back(batch.instances[i]);
+            batch.visibleLods.push_back(static_cast<unsigned char>(batch.model->SelectLod(lodSelection.maxPixelError / pixelsPerUnit)));
+        }
+        stats.visible += static_cast<int>(batch.visible.size());
+        stats.culled += static_cast<int>(batch.instances.size() - batch.visible.size()) - (stats.occluded - occludedBefore);
+        if (batch.visible.empty())
+            continue;
+
+        // group the instances by level, every level then draws one range of the instance buffer
+        unsigned int firstInstance[MESH_MAX_LODS + 1] = {};
+        for (unsigned char lod : batch.visibleLods)
+            firstInstance[lod + 1]++;
+        for (int lod = 0; lod < MESH_MAX_LODS; lod++) {
+            stats.lods[lod] += firstInstance[lod + 1];
+            firstInstance[lod + 1] += firstInstance[lod];
+        }
+        unsigned int next[MESH_MAX_LODS];
+        std::copy(firstInstance, firstInstance + MESH_MAX_LODS, next);
+        batch.byLod.resize(batch.visible.size());
+        for (size_t i = 0; i < batch.visible.size(); i++)
+            batch.byLod[next[batch.visibleLods[i]]++] = batch.visible[i];
+
+        batch.model->setInstances(batch.byLod.data(), batch.byLod.size());
+        for (int lod = 0; lod < MESH_MAX_LODS; lod++) {
+            if (firstInstance[lod + 1] > firstInstance[lod])
+                batch.model->Enqueue(renderQueue, shader, lod, firstInstance[lod], firstInstance[lod + 1] - firstInstance[lod]);
+        }
+    }
+#ifndef NDEBUG
+    assert(threadAllocations == allocationsBefore && "drawing the models must not allocate");
+#endif
+}
+
+
+// draws what the last queueInstanceBatches call queued, with program instead of the queued one when it is set
+void submitInstanceBatches(RenderQueueStats& queueStats, bool bindTextures, const Shader* program) {
+#ifndef NDEBUG
+    size_t allocationsBefore = threadAllocations;
+#endif
+    renderQueue.submit(queueStats, bindTextures, program);
+#ifndef NDEBUG
+    assert(threadAllocations == allocationsBefore && "drawing the models must not allocate");
+#endif
+}
+
+
+// picks up the occlusion query results that arrived since the last frame. called once per frame before the camera
+// passes, so all of them skip the same instances, and while idle. returns whether an instance changed visibility.
+bool collectOcclusion() {
+    bool changed = false;
+    for (InstanceBatch& batch : instanceBatches) {
+        // switching the current model or adding one reorders the instances, their old results would hide others
+        if (batch.queriedIds != batch.ids) {
+            batch.occlusion.reset(batch.ids.size());
+            batch.queriedIds = batch.ids;
+        }
+        changed |= batch.occlusion.collect();
+    }
+    return changed;
+}
+
+
+bool occlusionPending() {
+    for (const InstanceBatch& batch : instanceBatches) {
+        if (batch.occlusion.hasPending())
+            return true;
+    }
+    return false;
+}
+
+
+// draws the bounds of the instances the camera pass found in its frustum into the depth buffer of the frame, one
+// occlusion query each, without touching the colour or depth buffer. boxes hidden behind the walls and the
+// models drawn so far mark their instance as occluded for the next frames (see drawInstanceBatches).
+void queryOcclusion(Shader& shader, const glm::vec3& eye) {
+    shader.use();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    // the faces of a box can lie exactly on the surface of the model inside it
+    glDepthFunc(GL_LEQUAL);
+    glBindVertexArray(occlusionBoxVAO);
+    for (InstanceBatch& batch : instanceBatches) {
+        for (unsigned int i : batch.inFrustum) {
+            const AABB& bounds = batch.bounds[i];
+            // from inside the box (or closer to it than the near plane) its faces are clipped away
+            if (glm::all(glm::lessThanEqual(glm::abs(eye - bounds.center), bounds.extents + glm::vec3(0.1f)))) {
+                batch.occlusion.markVisible(i);
+                continue;
+            }
+            if (!batch.occlusion.begin(i))
+                continue;
+            shader.setVec3("boxCenter", bounds.center);
+            shader.setVec3("boxExtents", bounds.extents);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+            batch.occlusion.end(i);
+        }
+    }
+    glBindVertexArray(0);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+
 void resetApplication(GLFWwindow* window) {
     // Reset camera position and orientation
     camera = Camera(glm::vec3(0.0f, 7.0f, 5.0f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, -45.0f);
@@ -8,63 +8,31 @@ in vec3 Normal;
 in vec4 FragPosLightSpace;
 
 uniform sampler2D texture_diffuse1;
-uniform sampler2D shadowMap;
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 lightColor;
-uniform vec3 objectColor;
-uniform float ambientStrength;
-uniform float specularStrength;
-uniform float shininess;
-
-float ShadowCalculation(vec4 fragPosLightSpace)
-{
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    projCoords = projCoords * 0.5 + 0.5;
-    float closestDepth = texture(shadowMap, projCoords.xy).r; 
-    float currentDepth = projCoords.z;
-    vec3 normal = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
-    
-    //pcf
-    float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
-    for(int x = -1; x <= 1; ++x)
-    {
-        for(int y = -1; y <= 1; ++y)
-        {
-            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r; 
-            shadow += currentDepth - bias > pcfDepth  ? 1.0 : 0.0;        
-        }    
-    }
-    shadow /= 9.0;
-    
-    if(projCoords.z > 1.0)
-        shadow = 0.0;
-        
-    return shadow;
-}
+#include "frame_data.glsl"
+#include "shadow.glsl"
+#include "clustered_lights.glsl"
 
 void main()
 {
     vec3 norm = normalize(Normal);
 
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientStrength * lightColor1;
 
-    vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 lightDir = normalize(lightPos1 - FragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor;
+    vec3 diffuse = diff * lightColor1;
 
     vec3 viewDir = normalize(viewPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
-    vec3 specular = specularStrength * spec * lightColor;
+    vec3 specular = specularStrength * spec * lightColor1;
+
+    float shadow = ShadowCalculation(FragPosLightSpace, norm, lightDir);
 
-    float shadow = ShadowCalculation(FragPosLightSpace);
+    vec3 lamps = ClusteredLighting(FragPos, norm, viewDir, specularStrength, shininess);
 
-    vec3 result = (ambient + (1.0 - shadow) * (diffuse + specular)) * objectColor;
+    vec3 result = (ambient + (1.0 - shadow) * (diffuse + specular) + lamps) * objectColor;
 
     FragColor = texture(texture_diffuse1, TexCoords) * vec4(result, 1.0);
 }
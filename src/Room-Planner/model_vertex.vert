@@ -1,25 +1,35 @@
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 1) in vec2 aNormal; // octahedral encoded, see VertexFormat in mesh.h
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 7) in mat4 aModel; // per instance, see INSTANCE_MATRIX_LOCATION in mesh.h
+layout (location = 11) in mat3 aNormalMatrix; // per instance, inverse transpose of mat3(aModel)
 
 out vec2 TexCoords;
 out vec3 FragPos;      
 out vec3 Normal;       
 out vec4 FragPosLightSpace;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+#include "frame_data.glsl"
+
+// matches the depth pre-pass of shadow_mapping.vert bit for bit
+invariant gl_Position;
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 
 void main()
 {
     TexCoords = aTexCoords;
     
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = transpose(inverse(mat3(model))) * aNormal;
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
+    Normal = aNormalMatrix * decodeOctahedral(aNormal);
     FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
 
     gl_Position = projection * view * vec4(FragPos, 1.0);
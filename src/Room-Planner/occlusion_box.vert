@@ -0,0 +1,13 @@
+#version 330 core
+layout (location = 0) in vec3 aPos; // corner of the [-1, 1] cube
+
+#include "frame_data.glsl"
+
+// world space box tested by an occlusion query
+uniform vec3 boxCenter;
+uniform vec3 boxExtents;
+
+void main()
+{
+    gl_Position = projection * view * vec4(boxCenter + aPos * boxExtents, 1.0);
+}
\ No newline at end of file
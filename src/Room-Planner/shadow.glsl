@@ -0,0 +1,30 @@
+// shadow lookup shared by the lit shaders. the shadow map compares depths itself (GL_TEXTURE_COMPARE_MODE) and
+// filters the results bilinearly, so every tap already blends a 2x2 texel footprint.
+// SHADOW_KERNEL_SIZE taps per side, a kernel of 2 covers the same 3x3 texels as 9 manual compares.
+#ifndef SHADOW_KERNEL_SIZE
+#define SHADOW_KERNEL_SIZE 2
+#endif
+
+uniform sampler2DShadow shadowMap;
+
+// 1 for fully shadowed, 0 for lit
+float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
+{
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    if(projCoords.z > 1.0)
+        return 0.0;
+
+    float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    float lit = 0.0;
+    for(int x = 0; x < SHADOW_KERNEL_SIZE; ++x)
+    {
+        for(int y = 0; y < SHADOW_KERNEL_SIZE; ++y)
+        {
+            vec2 offset = vec2(x, y) - 0.5 * float(SHADOW_KERNEL_SIZE - 1);
+            lit += texture(shadowMap, vec3(projCoords.xy + offset * texelSize, projCoords.z - bias));
+        }
+    }
+    return 1.0 - lit / float(SHADOW_KERNEL_SIZE * SHADOW_KERNEL_SIZE);
+}
@@ -1,10 +1,21 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 7) in mat4 aModel; // per instance, a constant attribute for the walls
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+#include "frame_data.glsl"
+
+#ifdef CAMERA_DEPTH
+// the camera's depth pre-pass, the lit pass only shades fragments at exactly this depth (GL_EQUAL)
+invariant gl_Position;
+#endif
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+#ifdef CAMERA_DEPTH
+    // the same expressions as in model_vertex.vert, invariance only holds for identical computations
+    vec3 worldPos = vec3(aModel * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+#else
+    gl_Position = lightSpaceMatrix * aModel * vec4(aPos, 1.0);
+#endif
 }
\ No newline at end of file
@@ -8,15 +8,15 @@ out vec3 Normal;
 out vec4 FragPosLightSpace;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+uniform mat3 normalMatrix; // inverse transpose of mat3(model), set with it
+
+#include "frame_data.glsl"
 
 void main()
 {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal; // Transform normal to world space
+    Normal = normalMatrix * aNormal; // Transform normal to world space
     FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
 
     color = vec3(1.0,1.0,1.0);